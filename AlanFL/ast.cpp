@@ -0,0 +1,33 @@
+#include <algorithm>
+#include <cstdint>
+#include "ast.h"
+
+using namespace alanfl;
+using namespace std;
+
+void *ast_arena::allocate(const size_t size, const size_t align) {
+	auto p = reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(cur) + align - 1) & ~uintptr_t(align - 1));
+	if (cur == nullptr || p + size > end) { // Start a new chunk, oversized requests get a chunk of their own
+		const auto chunk_size = max(size + align, size_t(CHUNK_SIZE));
+		chunks.emplace_back(new char[chunk_size]);
+		chunk_bytes += chunk_size;
+		cur = chunks.back().get(), end = cur + chunk_size;
+		p = reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(cur) + align - 1) & ~uintptr_t(align - 1));
+	}
+	cur = p + size;
+	return p;
+}
+
+void ast_arena::reserve(const size_t bytes, const size_t count) {
+	nodes.reserve(nodes.size() + count);
+	if (cur != nullptr && size_t(end - cur) >= bytes)
+		return;
+	chunks.emplace_back(new char[bytes]);
+	chunk_bytes += bytes;
+	cur = chunks.back().get(), end = cur + bytes;
+}
+
+ast_arena::~ast_arena() {
+	for (auto it = nodes.rbegin(); it != nodes.rend(); ++it)
+		(*it)->~ast_node();
+}
@@ -1,10 +1,10 @@
 #pragma once
 
 #include <mpirxx.h>
+#include <cstddef>
 #include <utility>
 #include <memory>
 #include <string>
-#include <functional>
 #include <vector>
 #include "lexer.h"
 #include "operators.h"
@@ -27,6 +27,34 @@ namespace alanfl {
 #define IMPL_TYPEID static const int TYPE_ID = __LINE__ / 4; 
 #define INIT_TYPEID type_id = TYPE_ID;
 
+	/*
+	 * Where a variable lives, assigned by the resolver (see "resolver.h").
+	 * A local is declared in the depth-th scope of its frame, counting from the outermost scope,
+	 * and lives in the slot-th value of the frame on the vm stack.
+	 * A global is the slot-th global variable of the vm.
+	 */
+	struct address {
+		static const unsigned GLOBAL = ~0u;
+		unsigned depth = GLOBAL, slot = 0;
+		bool global() const { return depth == GLOBAL; }
+	};
+
+	struct expr_node;
+	struct stmt_node;
+	struct completion;
+	struct jit_function;
+
+	/*
+	 * Even a manual switch plus a virtual call is a lot for the vm to pay on every child it evaluates,
+	 * so expressions and statements also keep a pointer to the vm function running them (threaded dispatch).
+	 * A node starts with a handler that finds the real one and puts it in the node on first execution,
+	 * see "vm.cpp". Other visitors still dispatch with ast_visitor.
+	 */
+	using expr_handler = value (*)(vm &ctx, expr_node *node);
+	using stmt_handler = completion (*)(vm &ctx, stmt_node *node);
+	value thread_expr(vm &ctx, expr_node *node);
+	completion thread_stmt(vm &ctx, stmt_node *node);
+
 	struct ast_node {
 		virtual ~ast_node() = default;
 		int type_id; // Manually implemented typeid
@@ -38,6 +66,7 @@ namespace alanfl {
 	 */
 	struct expr_node : ast_node {
 		IMPL_TYPEID
+		expr_handler handler = thread_expr;
 		expr_node() { INIT_TYPEID }
 	};
 
@@ -54,21 +83,22 @@ namespace alanfl {
 	struct integer_node : expr_node {
 		IMPL_TYPEID
 		mpz_class value;
-		object::ptr value_obj;
-		explicit integer_node(mpz_class value) : value(std::move(value)), value_obj(std::make_shared<object>(this->value)) { INIT_TYPEID }
+		alanfl::value value_obj;
+		explicit integer_node(mpz_class value) : value(std::move(value)), value_obj(make_integer(this->value)) { INIT_TYPEID }
 	};
 
 	struct decimal_node : expr_node {
 		IMPL_TYPEID
 		mpf_class value;
-		object::ptr value_obj;
-		explicit decimal_node(mpf_class value) : value(std::move(value)), value_obj(std::make_shared<object>(this->value)) { INIT_TYPEID }
+		alanfl::value value_obj;
+		explicit decimal_node(mpf_class value) : value(std::move(value)), value_obj(object::ptr(new object(this->value))) { INIT_TYPEID }
 	};
 
 	struct identifier_node : expr_node {
 		IMPL_TYPEID
-		std::wstring id;
-		explicit identifier_node(std::wstring id) : id(std::move(id)) { INIT_TYPEID }
+		symbol id;
+		address addr;
+		explicit identifier_node(const symbol id) : id(id) { INIT_TYPEID }
 	};
 
 	/*
@@ -76,32 +106,44 @@ namespace alanfl {
 	 */
 	struct binop_node : expr_node {
 		IMPL_TYPEID
-		std::shared_ptr<expr_node> lhs, rhs;
+		expr_node *lhs, *rhs;
 		binary_op op;
-		binop_node(std::shared_ptr<expr_node> lhs, std::shared_ptr<expr_node> rhs, const binary_op op)
-			: lhs(std::move(lhs)), rhs(std::move(rhs)), op(op) {
+		quick_op quick = quick_op::unseen;
+		binop_node(expr_node *lhs, expr_node *rhs, const binary_op op)
+			: lhs(lhs), rhs(rhs), op(op) {
 			INIT_TYPEID
 		}
 	};
 
 	struct unop_node : expr_node {
 		IMPL_TYPEID
-		std::shared_ptr<expr_node> operand;
+		expr_node *operand;
 		unary_op op;
-		unop_node(std::shared_ptr<expr_node> operand, const unary_op op)
-			: operand(std::move(operand)), op(op) {
+		quick_op quick = quick_op::unseen;
+		unop_node(expr_node *operand, const unary_op op)
+			: operand(operand), op(op) {
 			INIT_TYPEID
 		}
 	};
 
+	/*
+	 * Monomorphic inline cache of a call site, planned by the vm when the callee differs from the last one.
+	 * Calls to the same function again skip the checks and bind arguments straight to param slots.
+	 */
+	struct call_cache {
+		fn_node *target = nullptr; // Function planned for, nullptr if nothing is called here yet
+		std::vector<value> defaults; // Params not given by the call site in order, undefined if its default is not a literal
+	};
+
 	/*
 	 * Function call
 	 */
 	struct fn_call_node : expr_node {
 		IMPL_TYPEID
-		std::shared_ptr<expr_node> callee;
-		std::vector<std::shared_ptr<expr_node>> args;
-		fn_call_node(std::shared_ptr<expr_node> callee) : callee(std::move(callee)) { INIT_TYPEID }
+		expr_node *callee;
+		std::vector<expr_node*> args;
+		call_cache cache;
+		fn_call_node(expr_node *callee) : callee(callee) { INIT_TYPEID }
 	};
 
 	/*
@@ -109,15 +151,16 @@ namespace alanfl {
 	 */
 	struct stmt_node : ast_node {
 		IMPL_TYPEID
+		stmt_handler handler = thread_stmt;
 		stmt_node() { INIT_TYPEID }
 	};
 
 
 	struct expr_stmt_node : stmt_node {
 		IMPL_TYPEID
-		std::shared_ptr<expr_node> expr;
-		expr_stmt_node(std::shared_ptr<expr_node> expr)
-			: expr(std::move(expr)) {
+		expr_node *expr;
+		expr_stmt_node(expr_node *expr)
+			: expr(expr) {
 			INIT_TYPEID
 		}
 	};
@@ -130,8 +173,8 @@ namespace alanfl {
 
 	struct return_stmt_node : stmt_node {
 		IMPL_TYPEID;
-		std::shared_ptr<expr_node> val;
-		return_stmt_node(std::shared_ptr<expr_node> val) : val(std::move(val)) { INIT_TYPEID }
+		expr_node *val;
+		return_stmt_node(expr_node *val) : val(val) { INIT_TYPEID }
 	};
 
 	struct empty_stmt_node : stmt_node {
@@ -141,68 +184,105 @@ namespace alanfl {
 
 	struct if_stmt_node : stmt_node {
 		IMPL_TYPEID
-		std::shared_ptr<expr_node> cond;
-		std::shared_ptr<stmt_node> branch, else_branch;
-		if_stmt_node(std::shared_ptr<expr_node> cond, 
-				std::shared_ptr<stmt_node> branch,
-				std::shared_ptr<stmt_node> else_branch) 
-		: cond(std::move(cond)), branch(std::move(branch)), else_branch(std::move(else_branch))
+		expr_node *cond;
+		stmt_node *branch, *else_branch;
+		if_stmt_node(expr_node *cond, 
+				stmt_node *branch,
+				stmt_node *else_branch) 
+		: cond(cond), branch(branch), else_branch(else_branch)
 		{ INIT_TYPEID }
 	};
 
 	struct while_stmt_node : stmt_node {
 		IMPL_TYPEID
-		std::shared_ptr<expr_node> cond;
-		std::shared_ptr<stmt_node> body;
-		while_stmt_node(std::shared_ptr<expr_node> cond, 
-			std::shared_ptr<stmt_node> body)
-			: cond(std::move(cond)), body(std::move(body))
+		expr_node *cond;
+		stmt_node *body;
+		while_stmt_node(expr_node *cond, 
+			stmt_node *body)
+			: cond(cond), body(body)
 		{ INIT_TYPEID }
 	};
 
 	struct block_node : stmt_node {
 		IMPL_TYPEID
-		std::vector<std::shared_ptr<stmt_node>> stmts;
+		std::vector<stmt_node*> stmts;
+		unsigned base = 0, slots = 0; // First frame slot and number of the variables declared directly in the block
 		block_node() { INIT_TYPEID }
 	};
 
-	struct intrinsic_node : stmt_node {
-		IMPL_TYPEID
-		std::function<void(vm &ctx)> body;
-		intrinsic_node(std::function<void(vm &ctx)> body) : body(std::move(body)) { INIT_TYPEID }
-	};
-
 	struct var_init_node : ast_node {
 		IMPL_TYPEID
-		std::shared_ptr<identifier_node> id;
-		std::shared_ptr<expr_node> init;
+		identifier_node *id;
+		expr_node *init;
+		address addr; // Where the variable is declared
 
-		var_init_node(std::shared_ptr<identifier_node> id, std::shared_ptr<expr_node> init)
-			: id(std::move(id)), init(std::move(init)) {
+		var_init_node(identifier_node *id, expr_node *init)
+			: id(id), init(init) {
 			INIT_TYPEID
 		}
 	};
 
 	struct fn_node : expr_node {
 		IMPL_TYPEID
-		std::vector<std::shared_ptr<var_init_node>> params;
-		std::vector<std::shared_ptr<var_init_node>> captures;
-		std::shared_ptr<stmt_node> body;
+		std::vector<var_init_node*> params;
+		std::vector<var_init_node*> captures;
+		stmt_node *body;
+		unsigned slots = 0; // Size of its frame, which starts with captures and then params
+		unsigned calls = 0; // Calls run by the tree-walker, counted only with the jit on
+		const jit_function *compiled = nullptr; // Machine code from the jit, see "jit.h"
 		fn_node() { INIT_TYPEID }
 	};
 
 	struct var_decl_node : stmt_node {
 		IMPL_TYPEID
-		std::vector<std::shared_ptr<var_init_node>> vars;
+		std::vector<var_init_node*> vars;
 		var_decl_node() { INIT_TYPEID }
 	};
 
 	struct module_node : ast_node {
 		IMPL_TYPEID
-		std::vector<std::shared_ptr<var_decl_node>> decls;
+		std::vector<var_decl_node*> decls;
+		unsigned slots = 0; // Size of the frame of code outside of functions, where lambdas evaluate captures
 		module_node() { INIT_TYPEID }
 	};
 
+	/*
+	 * Owner of the nodes of a parsed tree, nodes are bump-allocated in large chunks
+	 * and refer to each other by plain pointers, so the whole tree is freed at once with the arena.
+	 */
+	class ast_arena {
+		static const std::size_t CHUNK_SIZE = 64 * 1024;
+		std::vector<std::unique_ptr<char[]>> chunks;
+		char *cur = nullptr, *end = nullptr; // Free space of the current chunk
+		std::size_t chunk_bytes = 0; // Total size of the chunks
+		std::vector<ast_node*> nodes; // Nodes to destroy, nodes own strings, numbers and child lists
+
+		void *allocate(std::size_t size, std::size_t align);
+	public:
+		ast_arena() = default;
+		ast_arena(const ast_arena&) = delete;
+		ast_arena &operator=(const ast_arena&) = delete;
+		~ast_arena();
+
+		template <typename Node, typename ...Args>
+		Node *make(Args&&... args) {
+			const auto node = new (allocate(sizeof(Node), alignof(Node))) Node(std::forward<Args>(args)...);
+			nodes.emplace_back(node);
+			return node;
+		}
+
+		/*
+		 * Make room for count nodes taking up to bytes in total, so that they are made without allocating
+		 */
+		void reserve(std::size_t bytes, std::size_t count);
+
+		/*
+		 * Nodes made so far, and the memory of the chunks they are in (not counting what nodes own)
+		 */
+		std::size_t size() const { return nodes.size(); }
+		std::size_t bytes() const { return chunk_bytes; }
+	};
+
 	/*
 	 * The visitor for AST, but it is not implemented in the traditional visit / accept style. 
 	 * The traditional visit-accept style needs an 'accept' method defined in AST nodes, which helps
@@ -223,10 +303,10 @@ namespace alanfl {
 
 		// Define a visitor function for a certain type of node
 #define VISITOR_FUNCTION(subtype) \
-	virtual Ret visit_##subtype(const std::shared_ptr<subtype> &node, Args... args) { unexpected_visit(); }
+	virtual Ret visit_##subtype(subtype *node, Args... args) { unexpected_visit(); }
 		// Visitor function with fallback
 #define VISITOR_FUNCTION_FALLBACK(subtype, super) \
-	virtual Ret visit_##subtype(const std::shared_ptr<subtype> &node, Args... args) { return visit_##super(node, std::forward<Args>(args)...); }
+	virtual Ret visit_##subtype(subtype *node, Args... args) { return visit_##super(node, std::forward<Args>(args)...); }
 		VISITOR_FUNCTION(expr_node)
 		VISITOR_FUNCTION_FALLBACK(bool_node, expr_node)
 		VISITOR_FUNCTION_FALLBACK(integer_node, expr_node)
@@ -245,7 +325,6 @@ namespace alanfl {
 		VISITOR_FUNCTION_FALLBACK(break_stmt_node, stmt_node)
 		VISITOR_FUNCTION_FALLBACK(return_stmt_node, stmt_node)
 		VISITOR_FUNCTION_FALLBACK(block_node, stmt_node)
-		VISITOR_FUNCTION_FALLBACK(intrinsic_node, stmt_node)
 		VISITOR_FUNCTION_FALLBACK(var_decl_node, stmt_node)
 
 		VISITOR_FUNCTION(var_init_node)
@@ -256,9 +335,9 @@ namespace alanfl {
 		virtual ~ast_visitor() = default;
 
 		// Manual dispatch
-		Ret visit(const std::shared_ptr<ast_node> &node, Args... args) {
+		Ret visit(ast_node *node, Args... args) {
 #define DISPATCH(subtype) case subtype::TYPE_ID: \
-	return visit_##subtype(std::static_pointer_cast<subtype>(node), std::forward<Args>(args)...)
+	return visit_##subtype(static_cast<subtype*>(node), std::forward<Args>(args)...)
 			switch (node->type_id) {
 				DISPATCH(bool_node);
 				DISPATCH(integer_node);
@@ -276,7 +355,6 @@ namespace alanfl {
 				DISPATCH(break_stmt_node);
 				DISPATCH(return_stmt_node);
 				DISPATCH(block_node);
-				DISPATCH(intrinsic_node);
 				DISPATCH(var_decl_node);
 				DISPATCH(var_init_node);
 
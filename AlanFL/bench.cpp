@@ -0,0 +1,231 @@
+/*
+ * The execution benchmark of AlanFL, built on POSIX systems (see CMakeLists.txt)
+ *
+ * alanfl_bench [--warmup N] [--reps N] [--jit] [--bytecode] [--threads N] [script...]
+ *
+ * Each script (by default every .txt in the Benchmarks directory) is run in a child process of its own,
+ * warmup times and then reps times, each run on a fresh vm. Only exec is timed, lexing, parsing
+ * and optimizing are left to the front-end benchmark. Output of the scripts is discarded.
+ * With --threads, a run is the script run threads times at once on a pool of isolates (see "isolate.h"),
+ * whose workers keep their vms from run to run.
+ * One JSON object per script is printed: median, min and max time of a run, scripts run per second
+ * and the peak resident set size of the child.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "interpreter.h"
+#include "isolate.h"
+#include "lexer.h"
+#include "optimizer.h"
+#include "parser.h"
+#include "vm.h"
+
+using namespace std;
+using namespace alanfl;
+
+#ifndef BENCHMARK_DIR
+#define BENCHMARK_DIR "Benchmarks"
+#endif
+
+struct bench_options {
+	unsigned warmup = 2, reps = 10;
+	bool jit = false, bytecode = false;
+	unsigned threads = 0; // Isolates run at once, 0 to run on the main thread
+};
+
+/*
+ * Run a script once, returns the nanoseconds exec takes, or -1 if it cannot be parsed
+ */
+static int64_t run_once(const string &path, const bench_options &opts) {
+	vm_options vo;
+	vo.jit = opts.jit;
+	vm v(vo);
+	const auto src = source_buffer::from_file(path);
+	if (src == nullptr)
+		return -1;
+	auto par = make_shared<parser>(make_shared<lexer>(src, v.get_symbols()));
+	const auto mod = par->mod();
+	if (par->has_error())
+		return -1;
+	optimizer(v, *par->get_arena()).optimize(mod.get());
+	const auto start = chrono::steady_clock::now();
+	if (opts.bytecode)
+		interpreter(v).exec(mod);
+	else
+		v.exec(mod);
+	return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+}
+
+/*
+ * Parse and optimize a script for isolates, null if it cannot be parsed
+ */
+static shared_ptr<const shared_module> load_shared(const string &path) {
+	vm v;
+	const auto src = source_buffer::from_file(path);
+	if (src == nullptr)
+		return nullptr;
+	auto par = make_shared<parser>(make_shared<lexer>(src, v.get_symbols()));
+	const auto mod = par->mod();
+	if (par->has_error())
+		return nullptr;
+	optimizer(v, *par->get_arena()).optimize(mod.get());
+	return make_shared<const shared_module>(*mod, v.get_symbols());
+}
+
+/*
+ * Run a module once on every worker of the pool, returns the nanoseconds until all of them end, or -1 if one fails
+ */
+static int64_t run_batch(isolate_pool &pool, const shared_ptr<const shared_module> &mod) {
+	const auto start = chrono::steady_clock::now();
+	vector<future<shared_value>> results;
+	for (auto i = 0u; i < pool.size(); i++)
+		results.emplace_back(pool.submit(mod));
+	auto ok = true;
+	for (auto &r : results) {
+		try {
+			r.get();
+		} catch (...) { // Errors of the script, or a function returned
+			ok = false;
+		}
+	}
+	if (!ok)
+		return -1;
+	return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+}
+
+/*
+ * Runs of a script in a child process, times are sent back through a pipe
+ */
+static bool run_child(const string &path, const bench_options &opts, vector<int64_t> &times, long &peak_rss_kb) {
+	int fds[2];
+	if (pipe(fds) != 0)
+		return false;
+	const auto pid = fork();
+	if (pid < 0)
+		return false;
+	if (pid == 0) {
+		close(fds[0]);
+		unique_ptr<isolate_pool> pool;
+		shared_ptr<const shared_module> mod;
+		if (opts.threads > 0) {
+			// Discard what the script prints, workers share the stream which must stay good
+			const auto null = open("/dev/null", O_WRONLY);
+			if (null < 0 || dup2(null, STDOUT_FILENO) < 0)
+				_exit(1);
+			mod = load_shared(path);
+			if (mod == nullptr)
+				_exit(1);
+			vm_options vo;
+			vo.jit = opts.jit;
+			pool.reset(new isolate_pool(opts.threads, vo));
+		} else
+			wcout.rdbuf(nullptr); // Discard what the script prints
+		for (auto i = 0u; i < opts.warmup + opts.reps; i++) {
+			const auto t = pool != nullptr ? run_batch(*pool, mod) : run_once(path, opts);
+			if (t < 0)
+				_exit(1);
+			if (i >= opts.warmup && write(fds[1], &t, sizeof t) != sizeof t)
+				_exit(1);
+		}
+		_exit(0);
+	}
+	close(fds[1]);
+	int64_t t;
+	while (read(fds[0], &t, sizeof t) == sizeof t)
+		times.emplace_back(t);
+	close(fds[0]);
+	int status;
+	struct rusage usage;
+	if (wait4(pid, &status, 0, &usage) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+		return false;
+	peak_rss_kb = usage.ru_maxrss; // Kilobytes on Linux
+	return times.size() == opts.reps;
+}
+
+static string json_string(const string &s) {
+	string ret = "\"";
+	for (const auto c : s) {
+		if (c == '"' || c == '\\')
+			ret += '\\';
+		ret += c;
+	}
+	return ret + '"';
+}
+
+static void report(const string &path, const bench_options &opts) {
+	const auto name = filesystem::path(path).stem().string();
+	vector<int64_t> times;
+	long peak_rss_kb = 0;
+	if (!run_child(path, opts, times, peak_rss_kb)) {
+		printf("{\"benchmark\":%s,\"error\":\"cannot run script\"}\n", json_string(name).c_str());
+		fflush(stdout);
+		return;
+	}
+	sort(times.begin(), times.end());
+	const auto n = times.size();
+	const auto median = n % 2 == 1 ? double(times[n / 2]) : (times[n / 2 - 1] + times[n / 2]) / 2.0;
+	const auto engine = opts.bytecode ? "bytecode" : opts.jit ? "jit" : "tree";
+	const auto scripts = max(1u, opts.threads); // Run at once in a run
+	printf("{\"benchmark\":%s,\"engine\":\"%s\",\"threads\":%u,\"warmup\":%u,\"reps\":%u,"
+		"\"median_ms\":%.3f,\"min_ms\":%.3f,\"max_ms\":%.3f,\"ops_per_sec\":%.2f,\"peak_rss_kb\":%ld}\n",
+		json_string(name).c_str(), engine, opts.threads, opts.warmup, opts.reps,
+		median / 1e6, times.front() / 1e6, times.back() / 1e6, scripts * 1e9 / median, peak_rss_kb);
+	fflush(stdout);
+}
+
+int main(int argc, char **argv) {
+	bench_options opts;
+	vector<string> scripts;
+	for (auto i = 1; i < argc; i++) {
+		const string arg = argv[i];
+		if ((arg == "--warmup" || arg == "--reps") && i + 1 < argc)
+			(arg == "--warmup" ? opts.warmup : opts.reps) = unsigned(strtoul(argv[++i], nullptr, 10));
+		else if (arg == "--jit")
+			opts.jit = true;
+		else if (arg == "--bytecode")
+			opts.bytecode = true;
+		else if (arg == "--threads" && i + 1 < argc)
+			opts.threads = max(1u, unsigned(strtoul(argv[++i], nullptr, 10)));
+		else if (arg.compare(0, 2, "--") == 0) {
+			cerr << "usage: " << argv[0] << " [--warmup N] [--reps N] [--jit] [--bytecode] [--threads N] [script...]" << endl;
+			return 1;
+		} else
+			scripts.emplace_back(arg);
+	}
+	if (opts.reps == 0)
+		opts.reps = 1;
+	if (opts.bytecode && opts.threads > 0) {
+		cerr << "isolates run the tree-walker, --bytecode cannot be used with --threads" << endl;
+		return 1;
+	}
+	if (scripts.empty()) {
+		error_code ec;
+		for (const auto &entry : filesystem::directory_iterator(BENCHMARK_DIR, ec))
+			if (entry.path().extension() == ".txt")
+				scripts.emplace_back(entry.path().string());
+		sort(scripts.begin(), scripts.end());
+	}
+	if (scripts.empty()) {
+		cerr << "no benchmark scripts found" << endl;
+		return 1;
+	}
+	for (const auto &s : scripts)
+		report(s, opts);
+	return 0;
+}
@@ -0,0 +1,76 @@
+#include "bytecode.h"
+#include "ast.h"
+#include "util.h"
+
+using namespace alanfl;
+using namespace std;
+
+wstring alanfl::opcode_str(const opcode op) {
+	switch (op) {
+	case opcode::load_const: return L"load_const";
+	case opcode::load_nothing: return L"load_nothing";
+	case opcode::load_undefined: return L"load_undefined";
+	case opcode::load_bool: return L"load_bool";
+	case opcode::move: return L"move";
+	case opcode::get_global: return L"get_global";
+	case opcode::set_global: return L"set_global";
+	case opcode::def_global: return L"def_global";
+	case opcode::add: return L"add";
+	case opcode::sub: return L"sub";
+	case opcode::mul: return L"mul";
+	case opcode::div: return L"div";
+	case opcode::land: return L"land";
+	case opcode::lor: return L"lor";
+	case opcode::lt: return L"lt";
+	case opcode::lteq: return L"lteq";
+	case opcode::gt: return L"gt";
+	case opcode::gteq: return L"gteq";
+	case opcode::eq: return L"eq";
+	case opcode::neq: return L"neq";
+	case opcode::neg: return L"neg";
+	case opcode::lnot: return L"lnot";
+	case opcode::jump: return L"jump";
+	case opcode::jump_false: return L"jump_false";
+	case opcode::loop_false: return L"loop_false";
+	case opcode::closure: return L"closure";
+	case opcode::call: return L"call";
+	case opcode::tail_call: return L"tail_call";
+	case opcode::ret: return L"ret";
+	case opcode::ret_nothing: return L"ret_nothing";
+	case opcode::print: return L"print";
+	case opcode::missing_arg: return L"missing_arg";
+	case opcode::check_local: return L"check_local";
+	}
+	unreachable("converting opcode to string");
+	return wstring();
+}
+
+/*
+ * Debug function, dump the disassembly onto the stream
+ */
+void bytecode_function::dump(wostream &out) const {
+	out << L"function at " << (node == nullptr ? source_location() : node->begin)
+		<< L", params " << params << L", captures " << captures << L", registers " << registers << endl;
+	for (size_t i = 0; i < entries.size(); i++)
+		out << L"  entry " << i << L": " << entries[i] << endl;
+	for (size_t i = 0; i < consts.size(); i++)
+		out << L"  K[" << i << L"] = " << consts[i] << endl;
+	for (size_t pc = 0; pc < code.size(); pc++) {
+		auto &ins = code[pc];
+		out << L"  " << pc << L'\t' << opcode_str(ins.op) << L'\t';
+		if (ins.op == opcode::jump || ins.op == opcode::jump_false || ins.op == opcode::loop_false)
+			out << ins.a << L' ' << ins.target();
+		else
+			out << ins.a << L' ' << ins.b << L' ' << ins.c;
+		out << L"\t; " << locs[pc] << endl;
+	}
+}
+
+void bytecode_module::dump(wostream &out, const symbol_table &symbols) const {
+	for (size_t i = 0; i < globals.size(); i++)
+		out << L"G[" << i << L"] = " << symbols.name(globals[i]) << endl;
+	for (size_t i = 0; i < functions.size(); i++) {
+		out << L"P[" << i << L"] ";
+		functions[i]->dump(out);
+	}
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+/*
+ * The register bytecode for AlanFL, produced by the compiler and run by the interpreter
+ */
+
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include "lexer.h"
+#include "runtime.h"
+
+namespace alanfl {
+	/*
+	 * R[x] is a register of the current function, K[x] a constant, G[x] a global, P[x] a function prototype.
+	 * Registers are relative to the frame base, and a callee's frame starts right after its callee register,
+	 * so arguments are evaluated straight into the parameter registers.
+	 */
+	enum class opcode : std::uint8_t {
+		load_const,		// R[a] = K[b]
+		load_nothing,	// R[a] = nothing
+		load_undefined,	// R[a] = undefined, for a variable declared by a branch that may not be taken
+		load_bool,		// R[a] = b != 0
+		move,			// R[a] = R[b]
+		get_global,		// R[a] = G[b]
+		set_global,		// G[b] = R[a], G[b] must already exist
+		def_global,		// Define G[b] = R[a]
+		add, sub, mul, div,		// R[a] = R[b] op R[c]
+		land, lor,
+		lt, lteq, gt, gteq, eq, neq,
+		neg, lnot,		// R[a] = op R[b]
+		jump,			// pc = target
+		jump_false,		// if !R[a] then pc = target, R[a] must be boolean, for if conditions
+		loop_false,		// Same as jump_false, for while conditions
+		closure,		// R[a] = closure of P[b], capturing R[c] ... R[c + captures - 1]
+		call,			// R[a] = R[b](R[b + 1] ... R[b + c])
+		tail_call,		// return R[b](R[b + 1] ... R[b + c]), the callee reuses the frame
+		ret,			// return R[a]
+		ret_nothing,	// return nothing
+		print,			// print R[a], for EXPR_STMT_PRINT_RESULT
+		missing_arg,	// raise error for unprovided parameter R[a]
+		check_local		// raise error if R[a] is undefined, the variable is named by symbol b | c << 16
+	};
+
+	std::wstring opcode_str(opcode op);
+
+	/*
+	 * Operands are 16-bit, a jump target or a symbol takes both b and c
+	 */
+	struct instruction {
+		opcode op;
+		std::uint16_t a, b, c;
+
+		instruction(const opcode op, const std::uint16_t a = 0, const std::uint16_t b = 0, const std::uint16_t c = 0)
+			: op(op), a(a), b(b), c(c) {}
+
+		std::uint32_t target() const { return b | std::uint32_t(c) << 16; }
+		void set_target(const std::uint32_t t) { b = t & 0xffff, c = t >> 16; }
+	};
+
+	struct bytecode_module;
+
+	/*
+	 * A compiled function.
+	 * Registers are laid out as [params][captures][locals and temporaries],
+	 * entries[n] is where to start when called with n arguments, so that missing defaults get evaluated.
+	 */
+	struct bytecode_function {
+		bytecode_module *module; // The module it belongs to
+		fn_node *node = nullptr; // Corresponding AST node, null for the module initializer
+		std::vector<instruction> code;
+		std::vector<source_location> locs; // Source location of each instruction
+		std::vector<value> consts;
+		std::vector<std::uint32_t> entries;
+		unsigned params = 0, captures = 0, registers = 0;
+		bool entry = false; // Compiled as entry, its params may be left unset and reading them is checked
+
+		explicit bytecode_function(bytecode_module *module) : module(module) {}
+
+		void dump(std::wostream &out) const;
+	};
+
+	/*
+	 * A compiled module, functions[0] initializes the globals
+	 */
+	struct bytecode_module {
+		std::vector<std::unique_ptr<bytecode_function>> functions;
+		std::vector<symbol> globals; // Names of globals referred to by G[x]
+		std::vector<unsigned> global_ids; // The vm global id of G[x], linked by the interpreter
+
+		void dump(std::wostream &out, const symbol_table &symbols) const;
+	};
+}
@@ -0,0 +1,568 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <unordered_map>
+#include <vector>
+#include "cache.h"
+#include "util.h"
+
+using namespace alanfl;
+using namespace std;
+
+static const uint32_t MAGIC = 0x434c4641; // "AFLC"
+static const uint32_t VERSION = 1; // Bump whenever the layout, node kinds or operators change
+static const uint32_t NONE = ~0u; // Index of a missing child
+static const size_t KEY_SIZE = 4 * sizeof(uint32_t) + 2 * sizeof(uint64_t); // What a cache file starts with
+static const size_t MODULE_HEADER_SIZE = 2 * sizeof(uint32_t) + sizeof(uint64_t); // Counts and arena size
+static const size_t MIN_RECORD = 5 * sizeof(uint32_t); // Kind and location
+static const uint32_t MAX_PRECISION = 1 << 20; // Of decimals, in bits
+
+/*
+ * Node kinds in a file, TYPE_ID cannot be used since it moves whenever "ast.h" is edited
+ */
+enum node_kind : uint32_t {
+	k_bool, k_integer, k_decimal, k_identifier, k_binop, k_unop, k_fn_call, k_fn,
+	k_empty_stmt, k_expr_stmt, k_if_stmt, k_while_stmt, k_break_stmt, k_return_stmt, k_block,
+	k_var_init, k_var_decl, k_module
+};
+
+// Arena space a node takes at most, alignment included
+template <typename Node>
+static size_t node_bytes() { return sizeof(Node) + alignof(Node) - 1; }
+
+static const size_t MAX_NODE_BYTES = max({
+	node_bytes<bool_node>(), node_bytes<integer_node>(), node_bytes<decimal_node>(), node_bytes<identifier_node>(),
+	node_bytes<binop_node>(), node_bytes<unop_node>(), node_bytes<fn_call_node>(), node_bytes<fn_node>(),
+	node_bytes<empty_stmt_node>(), node_bytes<expr_stmt_node>(), node_bytes<if_stmt_node>(),
+	node_bytes<while_stmt_node>(), node_bytes<break_stmt_node>(), node_bytes<return_stmt_node>(),
+	node_bytes<block_node>(), node_bytes<var_init_node>(), node_bytes<var_decl_node>(), node_bytes<module_node>()
+});
+
+// FNV-1a, the key of a source
+static uint64_t source_hash(const source_buffer &src) {
+	uint64_t h = 0xcbf29ce484222325ull;
+	for (auto p = src.begin(); p != src.end(); ++p)
+		h = (h ^ static_cast<unsigned char>(*p)) * 0x100000001b3ull;
+	return h;
+}
+
+static void put32(string &out, const uint32_t x) {
+	out.append(reinterpret_cast<const char*>(&x), sizeof x);
+}
+
+static void put64(string &out, const uint64_t x) {
+	out.append(reinterpret_cast<const char*>(&x), sizeof x);
+}
+
+static void put_str(string &out, const string &s) {
+	put32(out, uint32_t(s.size()));
+	out += s;
+}
+
+/*
+ * Serializes a tree children first, a node shared by several parents is written once
+ */
+class cache_writer {
+	const symbol_table &symbols;
+	unordered_map<const ast_node*, uint32_t> ids;
+	unordered_map<symbol, uint32_t> symbol_ids;
+public:
+	string nodes, names; // Records of the nodes, and the name table
+	uint32_t node_count = 0, name_count = 0;
+	uint64_t arena_bytes = 0;
+
+	explicit cache_writer(const symbol_table &symbols) : symbols(symbols) {}
+
+	uint32_t name(const symbol sym) {
+		const auto res = symbol_ids.find(sym);
+		if (res != symbol_ids.end())
+			return res->second;
+		put_str(names, to_str(symbols.name(sym)));
+		return symbol_ids[sym] = name_count++;
+	}
+
+	template <typename Node>
+	vector<uint32_t> list(const vector<Node*> &nodes) {
+		vector<uint32_t> ret;
+		ret.reserve(nodes.size());
+		for (const auto n : nodes)
+			ret.emplace_back(write(n));
+		return ret;
+	}
+
+	uint32_t write(const ast_node *n);
+};
+
+uint32_t cache_writer::write(const ast_node *n) {
+	if (n == nullptr)
+		return NONE;
+	const auto res = ids.find(n);
+	if (res != ids.end())
+		return res->second;
+	string rec;
+	const auto head = [&](const node_kind k, const size_t bytes) {
+		put32(rec, k);
+		put32(rec, n->begin.line), put32(rec, n->begin.col);
+		put32(rec, n->end.line), put32(rec, n->end.col);
+		arena_bytes += bytes;
+	};
+	const auto put_list = [&](const vector<uint32_t> &l) {
+		put32(rec, uint32_t(l.size()));
+		for (const auto i : l)
+			put32(rec, i);
+	};
+	switch (n->type_id) {
+	case bool_node::TYPE_ID:
+		head(k_bool, node_bytes<bool_node>());
+		put32(rec, static_cast<const bool_node*>(n)->value);
+		break;
+	case integer_node::TYPE_ID: { // Sign and magnitude in 64-bit words, least significant first
+		const auto z = static_cast<const integer_node*>(n)->value.get_mpz_t();
+		vector<uint64_t> words((mpz_sizeinbase(z, 2) + 63) / 64);
+		size_t count = 0;
+		mpz_export(words.data(), &count, -1, sizeof(uint64_t), 0, 0, z);
+		head(k_integer, node_bytes<integer_node>());
+		put32(rec, mpz_sgn(z) < 0);
+		put32(rec, uint32_t(count));
+		for (auto i = 0u; i < count; i++)
+			put64(rec, words[i]);
+		break;
+	}
+	case decimal_node::TYPE_ID: { // The precision and the limbs as they are, so that the value is exact
+		const auto f = static_cast<const decimal_node*>(n)->value.get_mpf_t();
+		head(k_decimal, node_bytes<decimal_node>());
+		put32(rec, uint32_t(mpf_get_prec(f)));
+		put32(rec, uint32_t(int32_t(f->_mp_size)));
+		put64(rec, uint64_t(int64_t(f->_mp_exp)));
+		rec.append(reinterpret_cast<const char*>(f->_mp_d), abs(f->_mp_size) * sizeof(mp_limb_t));
+		break;
+	}
+	case identifier_node::TYPE_ID: {
+		const auto id = name(static_cast<const identifier_node*>(n)->id);
+		head(k_identifier, node_bytes<identifier_node>());
+		put32(rec, id);
+		break;
+	}
+	case binop_node::TYPE_ID: {
+		const auto node = static_cast<const binop_node*>(n);
+		const auto lhs = write(node->lhs), rhs = write(node->rhs);
+		head(k_binop, node_bytes<binop_node>());
+		put32(rec, lhs), put32(rec, rhs), put32(rec, uint32_t(node->op));
+		break;
+	}
+	case unop_node::TYPE_ID: {
+		const auto node = static_cast<const unop_node*>(n);
+		const auto operand = write(node->operand);
+		head(k_unop, node_bytes<unop_node>());
+		put32(rec, operand), put32(rec, uint32_t(node->op));
+		break;
+	}
+	case fn_call_node::TYPE_ID: {
+		const auto node = static_cast<const fn_call_node*>(n);
+		const auto callee = write(node->callee);
+		const auto args = list(node->args);
+		head(k_fn_call, node_bytes<fn_call_node>());
+		put32(rec, callee);
+		put_list(args);
+		break;
+	}
+	case fn_node::TYPE_ID: {
+		const auto node = static_cast<const fn_node*>(n);
+		const auto captures = list(node->captures), params = list(node->params);
+		const auto body = write(node->body);
+		head(k_fn, node_bytes<fn_node>());
+		put_list(captures);
+		put_list(params);
+		put32(rec, body);
+		break;
+	}
+	case empty_stmt_node::TYPE_ID:
+		head(k_empty_stmt, node_bytes<empty_stmt_node>());
+		break;
+	case expr_stmt_node::TYPE_ID: {
+		const auto expr = write(static_cast<const expr_stmt_node*>(n)->expr);
+		head(k_expr_stmt, node_bytes<expr_stmt_node>());
+		put32(rec, expr);
+		break;
+	}
+	case if_stmt_node::TYPE_ID: {
+		const auto node = static_cast<const if_stmt_node*>(n);
+		const auto cond = write(node->cond), branch = write(node->branch), else_branch = write(node->else_branch);
+		head(k_if_stmt, node_bytes<if_stmt_node>());
+		put32(rec, cond), put32(rec, branch), put32(rec, else_branch);
+		break;
+	}
+	case while_stmt_node::TYPE_ID: {
+		const auto node = static_cast<const while_stmt_node*>(n);
+		const auto cond = write(node->cond), body = write(node->body);
+		head(k_while_stmt, node_bytes<while_stmt_node>());
+		put32(rec, cond), put32(rec, body);
+		break;
+	}
+	case break_stmt_node::TYPE_ID:
+		head(k_break_stmt, node_bytes<break_stmt_node>());
+		put32(rec, static_cast<const break_stmt_node*>(n)->cnt);
+		break;
+	case return_stmt_node::TYPE_ID: {
+		const auto val = write(static_cast<const return_stmt_node*>(n)->val);
+		head(k_return_stmt, node_bytes<return_stmt_node>());
+		put32(rec, val);
+		break;
+	}
+	case block_node::TYPE_ID: {
+		const auto stmts = list(static_cast<const block_node*>(n)->stmts);
+		head(k_block, node_bytes<block_node>());
+		put_list(stmts);
+		break;
+	}
+	case var_init_node::TYPE_ID: {
+		const auto node = static_cast<const var_init_node*>(n);
+		const auto id = write(node->id), init = write(node->init);
+		head(k_var_init, node_bytes<var_init_node>());
+		put32(rec, id), put32(rec, init);
+		break;
+	}
+	case var_decl_node::TYPE_ID: {
+		const auto vars = list(static_cast<const var_decl_node*>(n)->vars);
+		head(k_var_decl, node_bytes<var_decl_node>());
+		put_list(vars);
+		break;
+	}
+	case module_node::TYPE_ID: {
+		const auto decls = list(static_cast<const module_node*>(n)->decls);
+		head(k_module, node_bytes<module_node>());
+		put_list(decls);
+		break;
+	}
+	default:
+		unreachable("caching unknown node");
+	}
+	nodes += rec;
+	return ids[n] = node_count++;
+}
+
+/*
+ * Decodes a mapped file, every read is checked against its end and every reference against the nodes read so far
+ */
+class cache_reader {
+	struct malformed {};
+
+	const char *p, *end;
+	symbol_table &symbols;
+	vector<symbol> names;
+	vector<ast_node*> nodes;
+
+	void need(const size_t n) const {
+		if (size_t(end - p) < n)
+			throw malformed();
+	}
+
+	ast_node *at(const uint32_t i) const {
+		if (i >= nodes.size())
+			throw malformed();
+		return nodes[i];
+	}
+
+	template <typename Node>
+	Node *as(const uint32_t i) const {
+		const auto n = at(i);
+		if (n->type_id != Node::TYPE_ID)
+			throw malformed();
+		return static_cast<Node*>(n);
+	}
+
+	expr_node *expr(const uint32_t i) const {
+		const auto n = at(i);
+		switch (n->type_id) {
+		case bool_node::TYPE_ID: case integer_node::TYPE_ID: case decimal_node::TYPE_ID:
+		case identifier_node::TYPE_ID: case binop_node::TYPE_ID: case unop_node::TYPE_ID:
+		case fn_call_node::TYPE_ID: case fn_node::TYPE_ID:
+			return static_cast<expr_node*>(n);
+		default:
+			throw malformed();
+		}
+	}
+
+	stmt_node *stmt(const uint32_t i) const {
+		const auto n = at(i);
+		switch (n->type_id) {
+		case empty_stmt_node::TYPE_ID: case expr_stmt_node::TYPE_ID: case if_stmt_node::TYPE_ID:
+		case while_stmt_node::TYPE_ID: case break_stmt_node::TYPE_ID: case return_stmt_node::TYPE_ID:
+		case block_node::TYPE_ID: case var_decl_node::TYPE_ID:
+			return static_cast<stmt_node*>(n);
+		default:
+			throw malformed();
+		}
+	}
+
+	template <typename Node, typename Get>
+	void list(vector<Node*> &out, Get get) {
+		const auto n = u32();
+		need(size_t(n) * sizeof(uint32_t));
+		out.reserve(n);
+		for (auto i = 0u; i < n; i++)
+			out.emplace_back(get(u32()));
+	}
+
+	void read_node(ast_arena &arena);
+public:
+	cache_reader(const char *begin, const char *end, symbol_table &symbols) : p(begin), end(end), symbols(symbols) {}
+
+	uint32_t u32() {
+		need(sizeof(uint32_t));
+		uint32_t x;
+		memcpy(&x, p, sizeof x);
+		p += sizeof x;
+		return x;
+	}
+
+	uint64_t u64() {
+		need(sizeof(uint64_t));
+		uint64_t x;
+		memcpy(&x, p, sizeof x);
+		p += sizeof x;
+		return x;
+	}
+
+	string str() {
+		const auto n = u32();
+		need(n);
+		string ret(p, n);
+		p += n;
+		return ret;
+	}
+
+	size_t left() const { return size_t(end - p); }
+
+	/*
+	 * Read the name table and the nodes, the root is the last node and must be a module
+	 */
+	module_node *read(ast_arena &arena, uint32_t name_count, uint32_t node_count);
+};
+
+module_node *cache_reader::read(ast_arena &arena, const uint32_t name_count, const uint32_t node_count) {
+	try {
+		names.reserve(name_count);
+		for (auto i = 0u; i < name_count; i++)
+			names.emplace_back(symbols.intern(to_wstr(str())));
+		nodes.reserve(node_count);
+		for (auto i = 0u; i < node_count; i++)
+			read_node(arena);
+		if (p != end || nodes.empty())
+			return nullptr;
+		return as<module_node>(uint32_t(nodes.size() - 1));
+	} catch (malformed&) {
+		return nullptr;
+	} catch (range_error&) { // A name that is not UTF-8
+		return nullptr;
+	}
+}
+
+void cache_reader::read_node(ast_arena &arena) {
+	const auto kind = u32();
+	source_location begin, end;
+	begin.line = u32(), begin.col = u32();
+	end.line = u32(), end.col = u32();
+	const auto opt_expr = [this](const uint32_t i) { return i == NONE ? nullptr : expr(i); };
+	ast_node *n;
+	switch (kind) {
+	case k_bool:
+		n = arena.make<bool_node>(u32() != 0);
+		break;
+	case k_integer: {
+		const auto neg = u32() != 0;
+		const auto count = u32();
+		need(size_t(count) * sizeof(uint64_t));
+		mpz_class z;
+		mpz_import(z.get_mpz_t(), count, -1, sizeof(uint64_t), 0, 0, p);
+		p += size_t(count) * sizeof(uint64_t);
+		if (neg)
+			mpz_neg(z.get_mpz_t(), z.get_mpz_t());
+		n = arena.make<integer_node>(move(z));
+		break;
+	}
+	case k_decimal: {
+		const auto prec = u32();
+		if (prec > MAX_PRECISION)
+			throw malformed();
+		mpf_class f(0, prec);
+		const auto size = int32_t(u32());
+		const auto exp = int64_t(u64());
+		const auto raw = f.get_mpf_t();
+		const auto limbs = size_t(size < 0 ? -int64_t(size) : size);
+		if (limbs > size_t(raw->_mp_prec) + 1) // Room mpf_init2 leaves for the limbs
+			throw malformed();
+		need(limbs * sizeof(mp_limb_t));
+		memcpy(raw->_mp_d, p, limbs * sizeof(mp_limb_t));
+		p += limbs * sizeof(mp_limb_t);
+		raw->_mp_size = size;
+		raw->_mp_exp = mp_exp_t(exp);
+		n = arena.make<decimal_node>(move(f));
+		break;
+	}
+	case k_identifier: {
+		const auto id = u32();
+		if (id >= names.size())
+			throw malformed();
+		n = arena.make<identifier_node>(names[id]);
+		break;
+	}
+	case k_binop: {
+		const auto lhs = expr(u32()), rhs = expr(u32());
+		const auto op = u32();
+		if (op > uint32_t(binary_op::neq))
+			throw malformed();
+		n = arena.make<binop_node>(lhs, rhs, binary_op(op));
+		break;
+	}
+	case k_unop: {
+		const auto operand = expr(u32());
+		const auto op = u32();
+		if (op > uint32_t(unary_op::lnot))
+			throw malformed();
+		n = arena.make<unop_node>(operand, unary_op(op));
+		break;
+	}
+	case k_fn_call: {
+		const auto node = arena.make<fn_call_node>(expr(u32()));
+		list(node->args, [this](const uint32_t i) { return expr(i); });
+		n = node;
+		break;
+	}
+	case k_fn: {
+		const auto node = arena.make<fn_node>();
+		const auto var = [this](const uint32_t i) { return as<var_init_node>(i); };
+		list(node->captures, var);
+		list(node->params, var);
+		node->body = stmt(u32());
+		n = node;
+		break;
+	}
+	case k_empty_stmt:
+		n = arena.make<empty_stmt_node>();
+		break;
+	case k_expr_stmt:
+		n = arena.make<expr_stmt_node>(expr(u32()));
+		break;
+	case k_if_stmt: {
+		const auto cond = expr(u32());
+		const auto branch = stmt(u32());
+		const auto else_id = u32();
+		n = arena.make<if_stmt_node>(cond, branch, else_id == NONE ? nullptr : stmt(else_id));
+		break;
+	}
+	case k_while_stmt: {
+		const auto cond = expr(u32());
+		n = arena.make<while_stmt_node>(cond, stmt(u32()));
+		break;
+	}
+	case k_break_stmt:
+		n = arena.make<break_stmt_node>(u32());
+		break;
+	case k_return_stmt:
+		n = arena.make<return_stmt_node>(expr(u32()));
+		break;
+	case k_block: {
+		const auto node = arena.make<block_node>();
+		list(node->stmts, [this](const uint32_t i) { return stmt(i); });
+		n = node;
+		break;
+	}
+	case k_var_init: {
+		const auto id = as<identifier_node>(u32());
+		n = arena.make<var_init_node>(id, opt_expr(u32()));
+		break;
+	}
+	case k_var_decl: {
+		const auto node = arena.make<var_decl_node>();
+		list(node->vars, [this](const uint32_t i) { return as<var_init_node>(i); });
+		n = node;
+		break;
+	}
+	case k_module: {
+		const auto node = arena.make<module_node>();
+		list(node->decls, [this](const uint32_t i) { return as<var_decl_node>(i); });
+		n = node;
+		break;
+	}
+	default:
+		throw malformed();
+	}
+	n->begin = begin, n->end = end;
+	nodes.emplace_back(n);
+}
+
+string module_cache::path_of(const uint64_t hash, const bool optimized) const {
+	char name[32];
+	snprintf(name, sizeof name, "%016llx%s.afc", static_cast<unsigned long long>(hash), optimized ? ".opt" : "");
+	return (filesystem::path(dir) / name).string();
+}
+
+string alanfl::encode_module(const module_node &mod, const symbol_table &symbols) {
+	cache_writer w(symbols);
+	w.write(&mod);
+	string out;
+	put32(out, w.name_count), put32(out, w.node_count);
+	put64(out, w.arena_bytes);
+	out += w.names;
+	out += w.nodes;
+	return out;
+}
+
+shared_ptr<module_node> alanfl::decode_module(const char *begin, const char *end, symbol_table &symbols) {
+	cache_reader in(begin, end, symbols);
+	if (in.left() < MODULE_HEADER_SIZE)
+		return nullptr;
+	const auto name_count = in.u32(), node_count = in.u32();
+	const auto arena_bytes = in.u64();
+	if (size_t(name_count) * sizeof(uint32_t) + size_t(node_count) * MIN_RECORD > in.left()
+		|| arena_bytes > uint64_t(node_count) * MAX_NODE_BYTES)
+		return nullptr; // Do not reserve what the file cannot hold
+	const auto arena = make_shared<ast_arena>();
+	arena->reserve(size_t(arena_bytes), node_count);
+	const auto mod = in.read(*arena, name_count, node_count);
+	if (mod == nullptr)
+		return nullptr;
+	return shared_ptr<module_node>(arena, mod);
+}
+
+shared_ptr<module_node> module_cache::load(const source_buffer &src, symbol_table &symbols, const bool optimized) const {
+	const auto hash = source_hash(src);
+	const auto file = source_buffer::from_file(path_of(hash, optimized));
+	if (file == nullptr)
+		return nullptr;
+	cache_reader in(file->begin(), file->end(), symbols);
+	if (in.left() < KEY_SIZE)
+		return nullptr;
+	if (in.u32() != MAGIC || in.u32() != VERSION || in.u32() != sizeof(mp_limb_t) || in.u32() != uint32_t(optimized))
+		return nullptr;
+	if (in.u64() != hash || in.u64() != uint64_t(src.end() - src.begin()))
+		return nullptr;
+	return decode_module(file->begin() + KEY_SIZE, file->end(), symbols);
+}
+
+bool module_cache::store(const source_buffer &src, const module_node &mod, const symbol_table &symbols, const bool optimized) const {
+	string out;
+	put32(out, MAGIC), put32(out, VERSION), put32(out, sizeof(mp_limb_t)), put32(out, uint32_t(optimized));
+	put64(out, source_hash(src)), put64(out, uint64_t(src.end() - src.begin()));
+	out += encode_module(mod, symbols);
+
+	error_code ec;
+	filesystem::create_directories(dir, ec);
+	const auto path = path_of(source_hash(src), optimized);
+	const auto tmp = path + '.' + to_string(random_device()()); // Written aside and renamed, readers never see half a file
+	{
+		ofstream fout(tmp, ios::binary);
+		if (!fout.write(out.data(), streamsize(out.size())))
+			return false;
+	}
+	filesystem::rename(tmp, path, ec);
+	if (ec) {
+		filesystem::remove(tmp, ec);
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include "ast.h"
+#include "source.h"
+#include "symbol.h"
+
+namespace alanfl {
+	/*
+	 * A module in the binary form of a cache file, without the key of its source.
+	 * It is decoded into a tree of its own with names interned into symbols, null if it is malformed.
+	 */
+	std::string encode_module(const module_node &mod, const symbol_table &symbols);
+	std::shared_ptr<module_node> decode_module(const char *begin, const char *end, symbol_table &symbols);
+
+	/*
+	 * A directory of parsed modules in binary form, so that a script that has not changed is not lexed
+	 * and parsed again. A module is keyed by a hash of its source, and by whether it was optimized.
+	 *
+	 * A cache file is mapped into memory (see source_buffer) and decoded in one pass.
+	 * Nodes are written children first and refer to each other by index, so the file does not depend
+	 * on where it is mapped, and names are stored once in a table of their own, interned on load.
+	 * The nodes are made in a single arena chunk sized by the file. Numbers keep their GMP limbs,
+	 * so that decimals are exact, a file written with limbs of another size is not read.
+	 * Only what the parser and the optimizer produce is stored, addresses, handlers, type feedback
+	 * and call caches are filled in by the vm as usual.
+	 * A file that is missing, stale, or malformed is a miss, it is never trusted beyond its bounds.
+	 */
+	class module_cache {
+		std::string dir;
+
+		std::string path_of(std::uint64_t hash, bool optimized) const;
+	public:
+		explicit module_cache(std::string dir) : dir(std::move(dir)) {}
+
+		/*
+		 * The module cached for the source, with names interned into symbols, null if there is none
+		 */
+		std::shared_ptr<module_node> load(const source_buffer &src, symbol_table &symbols, bool optimized) const;
+
+		/*
+		 * Cache a module parsed (and optimized, if so) from the source with symbols, false if it cannot be written
+		 */
+		bool store(const source_buffer &src, const module_node &mod, const symbol_table &symbols, bool optimized) const;
+	};
+}
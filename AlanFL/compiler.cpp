@@ -0,0 +1,464 @@
+#include <algorithm>
+#include "compiler.h"
+#include "util.h"
+
+using namespace alanfl;
+using namespace std;
+
+static const unsigned MAX_REGISTERS = 65535;
+
+uint32_t compiler::emit(const opcode op, const reg a, const uint16_t b, const uint16_t c) {
+	auto &fn = *cur().fn;
+	fn.code.emplace_back(op, a, b, c);
+	fn.locs.emplace_back(loc);
+	return uint32_t(fn.code.size() - 1);
+}
+
+void compiler::patch(const uint32_t at) {
+	auto &code = cur().fn->code;
+	code[at].set_target(uint32_t(code.size()));
+}
+
+compiler::reg compiler::alloc() {
+	auto &f = cur();
+	if (f.top >= MAX_REGISTERS)
+		throw runtime_error(L"function is too large to compile");
+	f.fn->registers = max(f.fn->registers, f.top + 1);
+	return reg(f.top++);
+}
+
+bool compiler::resolve(const symbol name, reg &r) {
+	auto &scopes = cur().scopes;
+	for (auto it = scopes.rbegin(); it != scopes.rend(); ++it) {
+		auto res = it->names.find(name);
+		if (res != it->names.end()) {
+			r = res->second;
+			return true;
+		}
+	}
+	return false;
+}
+
+uint16_t compiler::global(const symbol name) {
+	auto res = global_ids.find(name);
+	if (res != global_ids.end())
+		return res->second;
+	if (mod->globals.size() > 0xffff)
+		throw runtime_error(L"too many globals to compile");
+	const auto id = uint16_t(mod->globals.size());
+	mod->globals.emplace_back(name);
+	mod->global_ids.emplace_back(0);
+	global_ids[name] = id;
+	return id;
+}
+
+uint16_t compiler::constant(const value &val) {
+	auto &consts = cur().fn->consts;
+	if (consts.size() > 0xffff)
+		throw runtime_error(L"too many constants to compile");
+	consts.emplace_back(val);
+	return uint16_t(consts.size() - 1);
+}
+
+void compiler::declare(const symbol name, const reg r, const bool unset) {
+	auto &f = cur();
+	f.scopes.back().names[name] = r;
+	if (f.unset.size() <= r)
+		f.unset.resize(r + 1u);
+	f.unset[r] = unset;
+}
+
+bool compiler::may_be_unset(const reg r) {
+	const auto &unset = cur().unset;
+	return r < unset.size() && unset[r];
+}
+
+/*
+ * A variable declared by a branch that was not taken is not found, just like in the tree-walker
+ */
+void compiler::check(const symbol name, const reg r) {
+	if (may_be_unset(r))
+		emit(opcode::check_local, r, uint16_t(name), uint16_t(name >> 16));
+}
+
+void compiler::push_scope() {
+	cur().scopes.emplace_back(cur().locals);
+}
+
+/*
+ * Locals of the scope die here, so are the registers they take
+ */
+void compiler::pop_scope() {
+	auto &f = cur();
+	f.locals = f.top = f.scopes.back().locals;
+	f.scopes.pop_back();
+}
+
+void compiler::expr(expr_node *node, const reg dest) {
+	const auto saved_loc = loc;
+	const auto saved_top = cur().top;
+	loc = node->begin;
+	ec.visit(node, dest);
+	cur().top = saved_top; // Temporaries die with the expression
+	loc = saved_loc;
+}
+
+/*
+ * Get a register holding the value of an expression,
+ * locals are used in place, other expressions are computed into a new temporary
+ */
+compiler::reg compiler::expr_any(expr_node *node) {
+	reg r;
+	if (node->type_id == identifier_node::TYPE_ID && resolve(static_cast<identifier_node*>(node)->id, r)) {
+		check(static_cast<identifier_node*>(node)->id, r);
+		return r;
+	}
+	r = alloc();
+	expr(node, r);
+	return r;
+}
+
+/*
+ * The callee of a call goes to a fresh register on the top, followed by the arguments
+ */
+compiler::reg compiler::call_operands(fn_call_node *node) {
+	if (node->args.size() > 0xffff)
+		throw runtime_error(L"too many arguments to compile");
+	const auto callee = alloc();
+	expr(node->callee, callee);
+	for (auto &arg : node->args)
+		expr(arg, alloc());
+	return callee;
+}
+
+void compiler::stmt(stmt_node *node) {
+	const auto saved_loc = loc;
+	loc = node->begin;
+	visit(node);
+	auto &f = cur();
+	f.top = f.locals; // Temporaries die with the statement
+	loc = saved_loc;
+}
+
+/*
+ * Compile a lambda into a new function prototype, returns its index
+ */
+uint16_t compiler::function(fn_node *node) {
+	if (mod->functions.size() > 0xffff)
+		throw runtime_error(L"too many functions to compile");
+	mod->functions.emplace_back(make_unique<bytecode_function>(mod.get()));
+	const auto id = uint16_t(mod->functions.size() - 1);
+	const auto saved_loc = loc;
+	auto fn = mod->functions.back().get();
+	fn->node = node;
+	fn->params = unsigned(node->params.size());
+	fn->captures = unsigned(node->captures.size());
+	fn->entry = node == entry;
+
+	funcs.emplace_back(fn);
+	push_scope();
+	cur().top = fn->params + fn->captures;
+	if (cur().top > MAX_REGISTERS)
+		throw runtime_error(L"function is too large to compile");
+	fn->registers = cur().locals = cur().top;
+	for (auto i = 0u; i < fn->captures; i++) // Params are set after captures, so they hide captures of the same name
+		declare(node->captures[i]->id->id, reg(fn->params + i));
+	for (auto i = 0u; i < fn->params; i++) {
+		fn->entries.emplace_back(uint32_t(fn->code.size()));
+		auto &vi = node->params[i];
+		loc = vi->begin;
+		if (vi->init == nullptr)
+			emit(opcode::missing_arg, reg(i));
+		else
+			expr(vi->init, reg(i));
+		declare(vi->id->id, reg(i), fn->entry);
+	}
+	fn->entries.emplace_back(uint32_t(fn->code.size()));
+	stmt(node->body);
+	loc = node->end;
+	emit(opcode::ret_nothing);
+	funcs.pop_back();
+	loc = saved_loc;
+	return id;
+}
+
+unique_ptr<bytecode_module> compiler::compile(module_node *node, const symbol entry_name) {
+	mod = make_unique<bytecode_module>();
+	global_ids.clear();
+	entry = nullptr;
+	mod->functions.emplace_back(make_unique<bytecode_function>(mod.get()));
+	funcs.emplace_back(mod->functions.back().get());
+	cur().fn->entries.emplace_back(0);
+	for (auto &decl : node->decls) { // Initialize global variables in order
+		for (auto &vi : decl->vars) {
+			loc = vi->begin;
+			const auto r = alloc();
+			if (vi->id->id == entry_name && vi->init != nullptr && vi->init->type_id == fn_node::TYPE_ID)
+				entry = static_cast<fn_node*>(vi->init);
+			if (vi->init == nullptr)
+				emit(opcode::load_nothing, r);
+			else
+				expr(vi->init, r);
+			emit(opcode::def_global, r, global(vi->id->id));
+			cur().top = cur().locals;
+		}
+	}
+	loc = node->end;
+	emit(opcode::ret_nothing);
+	funcs.pop_back();
+	return move(mod);
+}
+
+void compiler::visit_empty_stmt_node(empty_stmt_node *node) {}
+
+/*
+ * How many variables a statement declares in its enclosing scope, through branches and loop bodies that are not blocks
+ */
+static unsigned declarations(stmt_node *node) {
+	if (node->type_id == var_decl_node::TYPE_ID)
+		return unsigned(static_cast<var_decl_node*>(node)->vars.size());
+	if (node->type_id == if_stmt_node::TYPE_ID) {
+		const auto s = static_cast<if_stmt_node*>(node);
+		return declarations(s->branch) + (s->else_branch == nullptr ? 0 : declarations(s->else_branch));
+	}
+	if (node->type_id == while_stmt_node::TYPE_ID)
+		return declarations(static_cast<while_stmt_node*>(node)->body);
+	return 0;
+}
+
+/*
+ * A branch or loop body that is not a block declares its variables in the enclosing scope,
+ * into the registers kept for them by reserve()
+ */
+void compiler::branch(stmt_node *node) {
+	const auto saved_bare = cur().bare;
+	const auto saved_reserved = cur().reserved;
+	cur().bare = node->type_id != block_node::TYPE_ID;
+	stmt(node);
+	cur().bare = saved_bare;
+	if (node->type_id == block_node::TYPE_ID) // Statements of the block kept registers of their own
+		cur().reserved = saved_reserved;
+}
+
+/*
+ * The variables an if or while statement declares through its branches are only set if their branch is taken,
+ * so the outermost such statement keeps a register for each of them, undefined until it is declared.
+ * Neither the condition nor anything the branches compute is left in them.
+ */
+void compiler::reserve(stmt_node *node) {
+	auto &f = cur();
+	if (f.bare) // Kept by the statement this one is a branch of
+		return;
+	f.top = f.reserved = f.locals;
+	for (auto n = declarations(node); n > 0; n--)
+		emit(opcode::load_undefined, alloc());
+	f.locals = f.top;
+}
+
+void compiler::visit_if_stmt_node(if_stmt_node *node) {
+	reserve(node);
+	const auto cond = expr_any(node->cond);
+	const auto to_else = emit(opcode::jump_false, cond);
+	cur().top = cur().locals;
+	branch(node->branch);
+	if (node->else_branch == nullptr) {
+		patch(to_else);
+		return;
+	}
+	const auto to_end = emit(opcode::jump);
+	patch(to_else);
+	branch(node->else_branch);
+	patch(to_end);
+}
+
+void compiler::visit_while_stmt_node(while_stmt_node *node) {
+	reserve(node);
+	const auto start = uint32_t(cur().fn->code.size());
+	const auto cond = expr_any(node->cond);
+	const auto to_end = emit(opcode::loop_false, cond);
+	cur().top = cur().locals;
+	cur().loops.emplace_back();
+	branch(node->body);
+	const auto back = emit(opcode::jump);
+	cur().fn->code[back].set_target(start);
+	patch(to_end);
+	for (auto at : cur().loops.back())
+		patch(at);
+	cur().loops.pop_back();
+}
+
+void compiler::visit_break_stmt_node(break_stmt_node *node) {
+	auto &loops = cur().loops;
+	const auto cnt = max(node->cnt, 1u); // 'break 0' stops the innermost loop, just like 'break 1'
+	if (cnt > loops.size())
+		throw runtime_error(L"cannot break out of a function");
+	loops[loops.size() - cnt].emplace_back(emit(opcode::jump));
+}
+
+/*
+ * Returning a call is a tail call, the callee takes over the frame
+ */
+void compiler::visit_return_stmt_node(return_stmt_node *node) {
+	if (node->val->type_id == fn_call_node::TYPE_ID) {
+		const auto call = static_cast<fn_call_node*>(node->val);
+		const auto callee = call_operands(call);
+		loc = call->begin;
+		emit(opcode::tail_call, 0, callee, uint16_t(call->args.size()));
+		return;
+	}
+	emit(opcode::ret, expr_any(node->val));
+}
+
+void compiler::visit_expr_stmt_node(expr_stmt_node *node) {
+	const auto r = alloc();
+	expr(node->expr, r);
+#ifdef EXPR_STMT_PRINT_RESULT
+	emit(opcode::print, r);
+#endif
+}
+
+void compiler::visit_var_decl_node(var_decl_node *node) {
+	for (auto &vi : node->vars)
+		visit(vi);
+}
+
+/*
+ * The new local takes the lowest free register, its initializer is compiled before it is declared
+ * so that the initializer still sees whatever the name referred to.
+ */
+void compiler::visit_var_init_node(var_init_node *node) {
+	auto &f = cur();
+	if (f.bare) { // Declared by a branch, see reserve()
+		const auto r = reg(f.reserved++);
+		if (node->init == nullptr)
+			emit(opcode::load_nothing, r);
+		else
+			expr(node->init, r);
+		declare(node->id->id, r, true);
+		return;
+	}
+	f.top = f.locals;
+	const auto r = alloc();
+	if (node->init == nullptr)
+		emit(opcode::load_nothing, r);
+	else
+		expr(node->init, r);
+	declare(node->id->id, r);
+	cur().locals = cur().top = r + 1u;
+}
+
+void compiler::visit_block_node(block_node *node) {
+	push_scope();
+	for (auto &s : node->stmts)
+		stmt(s);
+	pop_scope();
+}
+
+void compiler::expr_compiler::visit_bool_node(bool_node *node, const reg dest) {
+	ctx.emit(opcode::load_bool, dest, node->value);
+}
+
+void compiler::expr_compiler::visit_integer_node(integer_node *node, const reg dest) {
+	ctx.emit(opcode::load_const, dest, ctx.constant(node->value_obj));
+}
+
+void compiler::expr_compiler::visit_decimal_node(decimal_node *node, const reg dest) {
+	ctx.emit(opcode::load_const, dest, ctx.constant(node->value_obj));
+}
+
+void compiler::expr_compiler::visit_identifier_node(identifier_node *node, const reg dest) {
+	reg r;
+	if (ctx.resolve(node->id, r)) {
+		ctx.check(node->id, r);
+		if (r != dest)
+			ctx.emit(opcode::move, dest, r);
+	} else
+		ctx.emit(opcode::get_global, dest, ctx.global(node->id));
+}
+
+/*
+ * Captures are evaluated into consecutive registers, each one can see the previous ones,
+ * just like what the tree-walker does with a temporary scope
+ */
+void compiler::expr_compiler::visit_fn_node(fn_node *node, const reg dest) {
+	const auto base = ctx.cur().top;
+	ctx.cur().scopes.emplace_back(ctx.cur().locals);
+	for (auto &vi : node->captures) {
+		const auto r = ctx.alloc();
+		if (vi->init == nullptr)
+			ctx.emit(opcode::load_nothing, r);
+		else
+			ctx.expr(vi->init, r);
+		ctx.declare(vi->id->id, r);
+	}
+	ctx.cur().scopes.pop_back();
+	const auto proto = ctx.function(node);
+	ctx.emit(opcode::closure, dest, proto, reg(base));
+}
+
+void compiler::expr_compiler::visit_fn_call_node(fn_call_node *node, const reg dest) {
+	ctx.emit(opcode::call, dest, ctx.call_operands(node), uint16_t(node->args.size()));
+}
+
+void compiler::expr_compiler::visit_binop_node(binop_node *node, const reg dest) {
+	if (node->op == binary_op::assign) {
+		if (node->lhs->type_id != identifier_node::TYPE_ID)
+			throw runtime_error(L"expression cannot be used as lvalue!");
+		const auto name = static_cast<identifier_node*>(node->lhs)->id;
+		reg r;
+		if (!ctx.resolve(name, r)) {
+			ctx.expr(node->rhs, dest);
+			ctx.emit(opcode::set_global, dest, ctx.global(name));
+		} else if (ctx.may_be_unset(r)) { // The right side is evaluated before the variable is found
+			const auto val = dest == r ? ctx.alloc() : dest;
+			ctx.expr(node->rhs, val);
+			ctx.check(name, r);
+			ctx.emit(opcode::move, r, val);
+		} else {
+			ctx.expr(node->rhs, r);
+			if (r != dest)
+				ctx.emit(opcode::move, dest, r);
+		}
+		return;
+	}
+	// A local on the left is only used in place when the right side cannot assign to it
+	const auto rhs_pure = node->rhs->type_id == identifier_node::TYPE_ID
+		|| node->rhs->type_id == integer_node::TYPE_ID
+		|| node->rhs->type_id == decimal_node::TYPE_ID
+		|| node->rhs->type_id == bool_node::TYPE_ID;
+	reg lhs;
+	if (rhs_pure)
+		lhs = ctx.expr_any(node->lhs);
+	else
+		ctx.expr(node->lhs, lhs = ctx.alloc());
+	const auto rhs = ctx.expr_any(node->rhs);
+	switch (node->op) {
+	case binary_op::add: ctx.emit(opcode::add, dest, lhs, rhs); return;
+	case binary_op::sub: ctx.emit(opcode::sub, dest, lhs, rhs); return;
+	case binary_op::mul: ctx.emit(opcode::mul, dest, lhs, rhs); return;
+	case binary_op::div: ctx.emit(opcode::div, dest, lhs, rhs); return;
+	case binary_op::land: ctx.emit(opcode::land, dest, lhs, rhs); return;
+	case binary_op::lor: ctx.emit(opcode::lor, dest, lhs, rhs); return;
+	case binary_op::lt: ctx.emit(opcode::lt, dest, lhs, rhs); return;
+	case binary_op::lteq: ctx.emit(opcode::lteq, dest, lhs, rhs); return;
+	case binary_op::gt: ctx.emit(opcode::gt, dest, lhs, rhs); return;
+	case binary_op::gteq: ctx.emit(opcode::gteq, dest, lhs, rhs); return;
+	case binary_op::eq: ctx.emit(opcode::eq, dest, lhs, rhs); return;
+	case binary_op::neq: ctx.emit(opcode::neq, dest, lhs, rhs); return;
+	case binary_op::assign: break;
+	}
+	unreachable("compiling binary expression");
+}
+
+void compiler::expr_compiler::visit_unop_node(unop_node *node, const reg dest) {
+	const auto operand = ctx.expr_any(node->operand);
+	switch (node->op) {
+	case unary_op::neg: ctx.emit(opcode::neg, dest, operand); return;
+	case unary_op::lnot: ctx.emit(opcode::lnot, dest, operand); return;
+	}
+	unreachable("compiling unary expression");
+}
+
+void compiler::expr_compiler::unexpected_visit() {
+	unreachable("compiling expression");
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "ast.h"
+#include "bytecode.h"
+
+namespace alanfl {
+	/*
+	 * Compiles a module into register bytecode, see "bytecode.h".
+	 * Names are resolved here: a name is a local of the function being compiled if it is declared
+	 * in an enclosing block (or is a param / capture), otherwise it is a global.
+	 * Functions cannot see locals of their enclosing functions except through captures,
+	 * so resolution never crosses function boundaries.
+	 */
+	class compiler : public ast_visitor<> {
+		using reg = std::uint16_t;
+
+		// A block scope, names of its locals and how many registers were taken when it is entered
+		struct scope_state {
+			std::unordered_map<symbol, reg> names;
+			unsigned locals;
+
+			explicit scope_state(const unsigned locals) : locals(locals) {}
+		};
+
+		// Per-function compilation state, a stack of these is kept for nested lambdas
+		struct function_state {
+			bytecode_function *fn;
+			std::vector<scope_state> scopes;
+			std::vector<std::vector<std::uint32_t>> loops; // Unpatched break jumps of each enclosing loop
+			unsigned locals = 0; // Registers below this are taken by live locals
+			unsigned top = 0; // First free register
+			bool bare = false; // Compiling a branch or loop body that is not a block
+			unsigned reserved = 0; // Register of the next variable such a branch declares, see reserve()
+			std::vector<bool> unset; // Registers of variables declared by such a branch, which may be undefined
+
+			explicit function_state(bytecode_function *fn) : fn(fn) {}
+		};
+
+		std::unique_ptr<bytecode_module> mod;
+		std::vector<function_state> funcs; // Functions being compiled, back() is the current one
+		std::unordered_map<symbol, std::uint16_t> global_ids;
+		fn_node *entry = nullptr; // The lambda being defined as entry, whose params may be left unset
+		source_location loc; // Location of the node being compiled, recorded for each instruction
+
+		/*
+		 * Compiles an expression into a given register
+		 */
+		class expr_compiler : public ast_visitor<void, reg> {
+			compiler &ctx;
+			void unexpected_visit() override;
+
+			void visit_bool_node(bool_node *node, reg dest) override;
+			void visit_identifier_node(identifier_node *node, reg dest) override;
+			void visit_integer_node(integer_node *node, reg dest) override;
+			void visit_decimal_node(decimal_node *node, reg dest) override;
+			void visit_fn_node(fn_node *node, reg dest) override;
+			void visit_fn_call_node(fn_call_node *node, reg dest) override;
+			void visit_binop_node(binop_node *node, reg dest) override;
+			void visit_unop_node(unop_node *node, reg dest) override;
+		public:
+			explicit expr_compiler(compiler &ctx) : ctx(ctx) {}
+		} ec;
+
+		function_state &cur() { return funcs.back(); }
+		std::uint32_t emit(opcode op, reg a = 0, std::uint16_t b = 0, std::uint16_t c = 0);
+		void patch(std::uint32_t at); // Make the jump at 'at' jump to the next instruction
+		reg alloc();
+		bool resolve(symbol name, reg &r);
+		std::uint16_t global(symbol name);
+		std::uint16_t constant(const value &val);
+		void declare(symbol name, reg r, bool unset = false);
+		bool may_be_unset(reg r);
+		void check(symbol name, reg r);
+		void push_scope();
+		void pop_scope();
+
+		void expr(expr_node *node, reg dest);
+		reg expr_any(expr_node *node);
+		reg call_operands(fn_call_node *node);
+		void stmt(stmt_node *node);
+		void branch(stmt_node *node);
+		void reserve(stmt_node *node);
+		std::uint16_t function(fn_node *node);
+
+		void visit_empty_stmt_node(empty_stmt_node *node) override;
+		void visit_if_stmt_node(if_stmt_node *node) override;
+		void visit_while_stmt_node(while_stmt_node *node) override;
+		void visit_break_stmt_node(break_stmt_node *node) override;
+		void visit_return_stmt_node(return_stmt_node *node) override;
+		void visit_expr_stmt_node(expr_stmt_node *node) override;
+		void visit_var_decl_node(var_decl_node *node) override;
+		void visit_var_init_node(var_init_node *node) override;
+		void visit_block_node(block_node *node) override;
+	public:
+		compiler() : ec(*this) {}
+
+		/*
+		 * Compile errors (which the tree-walker would only report when executed) are thrown as runtime_error.
+		 * A lambda defined as the global named entry is started with its params unset, reading them is checked.
+		 */
+		std::unique_ptr<bytecode_module> compile(module_node *node, symbol entry_name);
+	};
+}
@@ -16,25 +16,25 @@ namespace alanfl {
 		std::map<std::wstring, std::wstring> props; // The 'properties' of nodes
 		nana::treebox tree; // The treeview
 
-		void visit_binop_node(const std::shared_ptr<binop_node> &node, std::wstring prefix) override;
-		void visit_unop_node(const std::shared_ptr<unop_node> &node, std::wstring prefix) override;
-		void visit_bool_node(const std::shared_ptr<bool_node> &node, std::wstring prefix) override;
-		void visit_integer_node(const std::shared_ptr<integer_node> &node, std::wstring prefix) override;
-		void visit_decimal_node(const std::shared_ptr<decimal_node> &node, std::wstring prefix) override;
-		void visit_fn_call_node(const std::shared_ptr<fn_call_node> &node, std::wstring prefix) override;
-		void visit_fn_node(const std::shared_ptr<fn_node> &node, std::wstring prefix) override;
-		void visit_expr_stmt_node(const std::shared_ptr<expr_stmt_node> &node, std::wstring prefix) override;
-		void visit_identifier_node(const std::shared_ptr<identifier_node> &node, std::wstring prefix) override;
-		void visit_if_stmt_node(const std::shared_ptr<if_stmt_node> &node, std::wstring prefix) override;
-		void visit_while_stmt_node(const std::shared_ptr<while_stmt_node> &node, std::wstring prefix) override;
-		void visit_break_stmt_node(const std::shared_ptr<break_stmt_node> &node, std::wstring prefix) override;
-		void visit_return_stmt_node(const std::shared_ptr<return_stmt_node> &node, std::wstring prefix) override;
-		void visit_block_node(const std::shared_ptr<block_node> &node, std::wstring prefix) override;
-		void visit_empty_stmt_node(const std::shared_ptr<empty_stmt_node> &node, std::wstring prefix) override;
-		void visit_var_decl_node(const std::shared_ptr<var_decl_node> &node, std::wstring prefix) override;
-		void visit_var_init_node(const std::shared_ptr<var_init_node> &node, std::wstring prefix) override;
+		void visit_binop_node(binop_node *node, std::wstring prefix) override;
+		void visit_unop_node(unop_node *node, std::wstring prefix) override;
+		void visit_bool_node(bool_node *node, std::wstring prefix) override;
+		void visit_integer_node(integer_node *node, std::wstring prefix) override;
+		void visit_decimal_node(decimal_node *node, std::wstring prefix) override;
+		void visit_fn_call_node(fn_call_node *node, std::wstring prefix) override;
+		void visit_fn_node(fn_node *node, std::wstring prefix) override;
+		void visit_expr_stmt_node(expr_stmt_node *node, std::wstring prefix) override;
+		void visit_identifier_node(identifier_node *node, std::wstring prefix) override;
+		void visit_if_stmt_node(if_stmt_node *node, std::wstring prefix) override;
+		void visit_while_stmt_node(while_stmt_node *node, std::wstring prefix) override;
+		void visit_break_stmt_node(break_stmt_node *node, std::wstring prefix) override;
+		void visit_return_stmt_node(return_stmt_node *node, std::wstring prefix) override;
+		void visit_block_node(block_node *node, std::wstring prefix) override;
+		void visit_empty_stmt_node(empty_stmt_node *node, std::wstring prefix) override;
+		void visit_var_decl_node(var_decl_node *node, std::wstring prefix) override;
+		void visit_var_init_node(var_init_node *node, std::wstring prefix) override;
 	public:
-		explicit ast_visualizer(const std::shared_ptr<ast_node> n)
+		explicit ast_visualizer(ast_node *n)
 			: form(nana::API::make_center(700, 700)),
 			tree(*this, { 0, 0, 700, 700 }) {
 			caption("Visualizing Node...");
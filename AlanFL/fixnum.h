@@ -0,0 +1,81 @@
+#pragma once
+
+/*
+ * Fixnums are integers that fit in 63 bits, kept as machine words instead of GMP integers.
+ * Arithmetic on them is checked, callers fall back to mpz_class when it reports an overflow.
+ * Operands are at most 63 bits, so sums and differences never overflow the 64-bit word,
+ * only the range check is needed; products need a real overflow check.
+ */
+
+#include <cstdint>
+#include <cstdlib>
+#include <mpirxx.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace alanfl {
+	using fixnum = std::int64_t;
+
+	const fixnum FIXNUM_MAX = (fixnum(1) << 62) - 1;
+	const fixnum FIXNUM_MIN = -FIXNUM_MAX; // Symmetric, so negation and division never overflow
+
+	inline bool fixnum_fits(const fixnum x) { return FIXNUM_MIN <= x && x <= FIXNUM_MAX; }
+
+	inline bool fixnum_add(const fixnum a, const fixnum b, fixnum &res) {
+		res = a + b;
+		return fixnum_fits(res);
+	}
+
+	inline bool fixnum_sub(const fixnum a, const fixnum b, fixnum &res) {
+		res = a - b;
+		return fixnum_fits(res);
+	}
+
+	inline bool fixnum_mul(const fixnum a, const fixnum b, fixnum &res) {
+#if defined(__GNUC__) || defined(__clang__)
+		return !__builtin_mul_overflow(a, b, &res) && fixnum_fits(res);
+#elif defined(_MSC_VER) && defined(_M_X64)
+		std::int64_t high;
+		res = _mul128(a, b, &high);
+		return high == (res >> 63) && fixnum_fits(res);
+#else
+		if (a != 0 && std::llabs(b) > FIXNUM_MAX / std::llabs(a))
+			return false;
+		res = a * b;
+		return fixnum_fits(res);
+#endif
+	}
+
+	// Truncating division like mpz_class, b must not be zero
+	inline bool fixnum_div(const fixnum a, const fixnum b, fixnum &res) {
+		res = a / b;
+		return true;
+	}
+
+	/*
+	 * Conversions between fixnums and mpz_class,
+	 * they go through mpz_import / mpz_export since 'long' is only 32-bit on Windows
+	 */
+	inline mpz_class fixnum_to_mpz(const fixnum x) {
+		mpz_class ret;
+		const std::uint64_t mag = x < 0 ? 0 - std::uint64_t(x) : std::uint64_t(x);
+		mpz_import(ret.get_mpz_t(), 1, 1, sizeof(mag), 0, 0, &mag);
+		if (x < 0)
+			mpz_neg(ret.get_mpz_t(), ret.get_mpz_t());
+		return ret;
+	}
+
+	inline bool mpz_to_fixnum(const mpz_class &z, fixnum &res) {
+		if (mpz_sgn(z.get_mpz_t()) == 0) {
+			res = 0;
+			return true;
+		}
+		if (mpz_sizeinbase(z.get_mpz_t(), 2) > 62)
+			return false;
+		std::uint64_t mag = 0;
+		mpz_export(&mag, nullptr, 1, sizeof(mag), 0, 0, z.get_mpz_t());
+		res = mpz_sgn(z.get_mpz_t()) < 0 ? -fixnum(mag) : fixnum(mag);
+		return true;
+	}
+}
@@ -0,0 +1,227 @@
+/*
+ * The front-end benchmark of AlanFL, measuring the lexer and the parser on generated programs
+ *
+ * alanfl_frontend_bench [--size BYTES] [--reps N] [--seed N] [--dump] [shape...]
+ *
+ * A program of about size bytes is generated for each shape:
+ *   nesting - declarations initialized with deeply nested expressions
+ *   decls   - many variable declarations, global and local
+ *   blocks  - functions with large blocks of statements
+ *   lambdas - many small lambdas with captures, params and defaults, nested in each other
+ *   mixed   - all of the above in turn
+ * Lexing alone (next_token until eof) and parsing (parser::mod(), which lexes as it goes) are each
+ * repeated reps times on the source in memory, the fastest run is reported as one JSON object
+ * per shape: tokens and bytes per second of the lexer, nodes and bytes per second of the parser,
+ * and the memory of the tree: the arena chunks, and all of the heap the parse took on glibc.
+ * --dump prints the generated programs instead.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#include "lexer.h"
+#include "parser.h"
+
+using namespace std;
+using namespace alanfl;
+
+/*
+ * Generates AlanFL source, every program is a module of global declarations with an entry
+ */
+class program_generator {
+	mt19937 rng;
+	string out;
+	unsigned next_id = 0;
+
+	unsigned pick(const unsigned n) { return uniform_int_distribution<unsigned>(0, n - 1)(rng); }
+	string fresh(const char *prefix) { return prefix + to_string(next_id++); }
+
+	string leaf(const string &var) {
+		switch (pick(4)) {
+		case 0: return to_string(pick(1000));
+		case 1: return to_string(pick(100)) + "." + to_string(pick(100));
+		default: return var;
+		}
+	}
+
+	string nested(const unsigned depth, const string &var) {
+		static const char *ops[] = { " + ", " - ", " * ", " / " };
+		if (depth == 0)
+			return leaf(var);
+		switch (pick(8)) {
+		case 0: return "-(" + nested(depth - 1, var) + ")";
+		case 1: return "f(" + nested(depth - 1, var) + ", " + leaf(var) + ")";
+		default: return "(" + nested(depth - 1, var) + ops[pick(4)] + leaf(var) + ")";
+		}
+	}
+
+	void nesting() {
+		const auto name = fresh("e");
+		out += "var " + name + " = " + nested(32 + pick(32), "x") + ";\n";
+	}
+
+	void decls() {
+		out += "var ";
+		for (auto i = 0u, n = 4 + pick(8); i < n; i++) {
+			const auto name = fresh("v");
+			out += (i == 0 ? "" : ", ") + name;
+			if (pick(3) != 0)
+				out += " = " + leaf("x");
+		}
+		out += ";\n";
+		const auto name = fresh("d");
+		out += "var " + name + " = fn {\n";
+		for (auto i = 0u, n = 8 + pick(8); i < n; i++)
+			out += "\tvar l" + to_string(i) + " = " + leaf("x") + ", m" + to_string(i) + ";\n";
+		out += "};\n";
+	}
+
+	void blocks() {
+		out += "var " + fresh("b") + " = fn (a, b = 1) {\n\tvar t = a + b;\n";
+		for (auto i = 0u, n = 200 + pick(200); i < n; i++) {
+			switch (pick(5)) {
+			case 0: out += "\tt = t + a * " + to_string(pick(100)) + ";\n"; break;
+			case 1: out += "\tif (t < " + to_string(pick(100)) + ") t = t + 1; else { t = t - 1; a = a + t; }\n"; break;
+			case 2: out += "\twhile (t > 0 && a != b) { t = t - 1; if (t == 3) break; }\n"; break;
+			case 3: out += "\tprint_line(t);\n"; break;
+			default: out += "\t{ var u = t; u = u / 2; a = u; }\n"; break;
+			}
+		}
+		out += "\treturn t;\n};\n";
+	}
+
+	void lambdas() {
+		const auto name = fresh("l");
+		out += "var " + name + " = fn [c = " + to_string(pick(100)) + "] (x, y = 2) {\n"
+			"\tvar g = fn [x = x, c = c] (z) { return x + z * c; };\n"
+			"\treturn fn [g = g, y = y] (w) { return g(w) - y; }(x);\n};\n";
+	}
+public:
+	explicit program_generator(const unsigned seed) : rng(seed) {}
+
+	string generate(const string &shape, const size_t size) {
+		out.clear();
+		next_id = 0;
+		out += "var x = 1, f = fn (a, b) { return a + b; };\n";
+		for (auto i = 0u; out.size() < size; i++) {
+			const auto s = shape != "mixed" ? shape : i % 4 == 0 ? "nesting" : i % 4 == 1 ? "decls" : i % 4 == 2 ? "blocks" : "lambdas";
+			if (s == "nesting")
+				nesting();
+			else if (s == "decls")
+				decls();
+			else if (s == "blocks")
+				blocks();
+			else
+				lambdas();
+		}
+		out += "var entry = fn { print_line(x); };\n";
+		return out;
+	}
+};
+
+static size_t heap_in_use() {
+#ifdef __GLIBC__
+#if __GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33)
+	return mallinfo2().uordblks;
+#else
+	return size_t(mallinfo().uordblks);
+#endif
+#else
+	return 0;
+#endif
+}
+
+static double seconds_since(const chrono::steady_clock::time_point start) {
+	return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+static bool report(const string &shape, const string &text, const unsigned reps) {
+	const auto src = make_shared<source_buffer>(text);
+	size_t tokens = 0, nodes = 0, arena_bytes = 0, heap_bytes = 0;
+	double lex_time = 1e300, parse_time = 1e300;
+	for (auto i = 0u; i < reps; i++) {
+		symbol_table symbols;
+		lexer lex(src, symbols);
+		tokens = 0;
+		const auto start = chrono::steady_clock::now();
+		while (lex.next_token().type != token_type::eof)
+			tokens++;
+		lex_time = min(lex_time, seconds_since(start));
+	}
+	for (auto i = 0u; i < reps; i++) {
+		symbol_table symbols;
+		const auto heap_before = heap_in_use();
+		const auto start = chrono::steady_clock::now();
+		const auto par = make_shared<parser>(make_shared<lexer>(src, symbols));
+		const auto mod = par->mod();
+		parse_time = min(parse_time, seconds_since(start));
+		const auto heap_after = heap_in_use();
+		if (par->has_error()) {
+			par->dump_error();
+			printf("{\"shape\":\"%s\",\"error\":\"generated program does not parse\"}\n", shape.c_str());
+			return false;
+		}
+		nodes = par->get_arena()->size();
+		arena_bytes = par->get_arena()->bytes();
+		heap_bytes = heap_after > heap_before ? heap_after - heap_before : 0;
+	}
+	printf("{\"shape\":\"%s\",\"bytes\":%zu,\"tokens\":%zu,\"nodes\":%zu,"
+		"\"lex_tokens_per_sec\":%.0f,\"lex_bytes_per_sec\":%.0f,"
+		"\"parse_nodes_per_sec\":%.0f,\"parse_bytes_per_sec\":%.0f,"
+		"\"arena_bytes\":%zu,\"heap_bytes\":%zu}\n",
+		shape.c_str(), text.size(), tokens, nodes,
+		tokens / lex_time, text.size() / lex_time,
+		nodes / parse_time, text.size() / parse_time,
+		arena_bytes, heap_bytes);
+	fflush(stdout);
+	return true;
+}
+
+int main(int argc, char **argv) {
+	size_t size = 1 << 20;
+	unsigned reps = 5, seed = 1;
+	bool dump = false;
+	vector<string> shapes;
+	for (auto i = 1; i < argc; i++) {
+		const string arg = argv[i];
+		if (arg == "--size" && i + 1 < argc)
+			size = size_t(strtoull(argv[++i], nullptr, 10));
+		else if (arg == "--reps" && i + 1 < argc)
+			reps = max(1u, unsigned(strtoul(argv[++i], nullptr, 10)));
+		else if (arg == "--seed" && i + 1 < argc)
+			seed = unsigned(strtoul(argv[++i], nullptr, 10));
+		else if (arg == "--dump")
+			dump = true;
+		else if (arg == "nesting" || arg == "decls" || arg == "blocks" || arg == "lambdas" || arg == "mixed")
+			shapes.emplace_back(arg);
+		else {
+			cerr << "usage: " << argv[0] << " [--size BYTES] [--reps N] [--seed N] [--dump] "
+				"[nesting|decls|blocks|lambdas|mixed...]" << endl;
+			return 1;
+		}
+	}
+	if (shapes.empty())
+		shapes = { "nesting", "decls", "blocks", "lambdas", "mixed" };
+	program_generator gen(seed);
+	auto ok = true;
+	for (const auto &shape : shapes) {
+		const auto text = gen.generate(shape, size);
+		if (dump)
+			cout << text;
+		else
+			ok = report(shape, text, reps) && ok;
+	}
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,185 @@
+#include <algorithm>
+#include <iostream>
+#include "compiler.h"
+#include "interpreter.h"
+#include "resolver.h"
+
+using namespace alanfl;
+using namespace std;
+
+void interpreter::exec(const shared_ptr<module_node> &node) {
+	try {
+		ctx.trees.emplace_back(node);
+		compiler comp;
+		modules.emplace_back(comp.compile(node.get(), ctx.symbols.intern(L"entry")));
+		auto &mod = *modules.back();
+		for (size_t i = 0; i < mod.globals.size(); i++) // Link globals to the vm
+			mod.global_ids[i] = ctx.global_id(mod.globals[i]);
+		run(mod.functions[0].get(), 0, 0); // Initialize global variables in order
+		const auto entry = ctx.get_global(ctx.global_id(L"entry"));
+		const auto code = entry.type == object_type::function ? entry.f_val().code : nullptr;
+		if (code == nullptr || (code->params > 0 && !code->entry)) { // Its params cannot be left unset, walk the tree
+			resolver(ctx).resolve(node.get());
+			ctx.start(entry, nullptr, 0);
+			return;
+		}
+		stack[0] = entry;
+		enter(0, 0); // Params are left unset, as the tree-walker does
+		fill_n(stack.begin() + 1, code->params, value());
+		const vm::call_depth counted(ctx);
+		run(code, 1, code->entries[code->params]);
+	} catch (runtime_error &re) {
+		wcout << re.message << endl;
+	} catch (logic_error &le) {
+		wcout << le.what() << endl;
+	}
+}
+
+/*
+ * Call the function in the callee register with the arguments following it,
+ * the callee's frame starts right after the callee register
+ */
+value interpreter::call(const size_t callee, const unsigned argc) {
+	if (stack[callee].type == object_type::native) // Arguments are passed where they are
+		return ctx.call_native(*stack[callee].nf_val, stack.data() + callee + 1, argc);
+	const auto code = enter(callee, argc);
+	if (code == nullptr) // Not compiled by us, let the tree-walker do it
+		return ctx.call(stack[callee], stack.data() + callee + 1, argc);
+	const vm::call_depth counted(ctx);
+	return run(code, callee + 1, code->entries[argc]);
+}
+
+/*
+ * Check a call and set up the frame of the callee, returns nullptr if the callee has no bytecode
+ */
+const bytecode_function *interpreter::enter(const size_t callee, const unsigned argc) {
+	auto &fn = stack[callee];
+	if (fn.type != object_type::function) // If callee is not a function
+		throw runtime_error(L"can not \"call\" a non-function object");
+	if (argc > fn.f_val().func->params.size()) // If we have more arguments than callee is expected to receive
+		throw runtime_error(L"too many arguments to call function");
+
+	const auto code = fn.f_val().code;
+	if (code == nullptr)
+		return nullptr;
+	const auto base = callee + 1;
+	if (stack.size() < base + code->registers)
+		stack.resize(max(base + code->registers, stack.size() * 2));
+	const auto &captured = stack[callee].f_val().captured; // Stack may have been resized
+	copy(captured.begin(), captured.end(), stack.begin() + base + code->params);
+	return code;
+}
+
+value interpreter::run(const bytecode_function *fn, const size_t base, uint32_t pc) {
+	auto code = fn->code.data();
+	auto consts = fn->consts.data();
+	auto mod = fn->module;
+	auto regs = stack.data() + base;
+	for (;;) {
+		const auto &ins = code[pc++];
+		switch (ins.op) {
+		case opcode::load_const:
+			regs[ins.a] = consts[ins.b];
+			break;
+		case opcode::load_nothing:
+			regs[ins.a] = ctx.get_nothing();
+			break;
+		case opcode::load_undefined:
+			regs[ins.a] = value();
+			break;
+		case opcode::load_bool:
+			regs[ins.a] = ctx.get_bool(ins.b != 0);
+			break;
+		case opcode::move:
+			regs[ins.a] = regs[ins.b];
+			break;
+		case opcode::get_global:
+			regs[ins.a] = ctx.get_global(mod->global_ids[ins.b]);
+			break;
+		case opcode::set_global:
+			ctx.get_global(mod->global_ids[ins.b]) = regs[ins.a];
+			break;
+		case opcode::def_global:
+			ctx.globals[mod->global_ids[ins.b]] = regs[ins.a];
+			break;
+#define BINOP(op_code, op_enum) case op_code: \
+			regs[ins.a] = ctx.binop(op_enum, regs[ins.b], regs[ins.c]); \
+			break;
+		BINOP(opcode::add, binary_op::add)
+		BINOP(opcode::sub, binary_op::sub)
+		BINOP(opcode::mul, binary_op::mul)
+		BINOP(opcode::div, binary_op::div)
+		BINOP(opcode::land, binary_op::land)
+		BINOP(opcode::lor, binary_op::lor)
+		BINOP(opcode::lt, binary_op::lt)
+		BINOP(opcode::lteq, binary_op::lteq)
+		BINOP(opcode::gt, binary_op::gt)
+		BINOP(opcode::gteq, binary_op::gteq)
+		BINOP(opcode::eq, binary_op::eq)
+		BINOP(opcode::neq, binary_op::neq)
+#undef BINOP
+		case opcode::neg:
+			regs[ins.a] = ctx.unop(unary_op::neg, regs[ins.b]);
+			break;
+		case opcode::lnot:
+			regs[ins.a] = ctx.unop(unary_op::lnot, regs[ins.b]);
+			break;
+		case opcode::jump:
+			pc = ins.target();
+			break;
+		case opcode::jump_false:
+			if (regs[ins.a].type != object_type::boolean)
+				throw runtime_error(L"condition for an if stmt must be boolean!");
+			if (!regs[ins.a].b_val)
+				pc = ins.target();
+			break;
+		case opcode::loop_false:
+			if (regs[ins.a].type != object_type::boolean)
+				throw runtime_error(L"condition for a while stmt must be boolean!");
+			if (!regs[ins.a].b_val)
+				pc = ins.target();
+			break;
+		case opcode::closure: {
+			const auto &proto = *mod->functions[ins.b];
+			auto ret = value(ctx.pool.function(proto.node));
+			ret.f_val().code = &proto;
+			ret.f_val().captured.assign(regs + ins.c, regs + ins.c + proto.captures);
+			regs[ins.a] = move(ret);
+			break;
+		}
+		case opcode::call: {
+			auto ret = call(base + ins.b, ins.c);
+			regs = stack.data() + base; // Stack may have been resized
+			regs[ins.a] = move(ret);
+			break;
+		}
+		case opcode::tail_call: {
+			const auto &callee = regs[ins.b];
+			if (callee.type != object_type::function || callee.f_val().code == nullptr)
+				return call(base + ins.b, ins.c); // Nothing to reuse, or an error to report
+			for (auto i = 0u; i <= ins.c; i++) // Callee and arguments take the place of ours
+				stack[base - 1 + i] = move(regs[ins.b + i]);
+			fn = enter(base - 1, ins.c);
+			regs = stack.data() + base; // Stack may have been resized
+			code = fn->code.data();
+			consts = fn->consts.data();
+			mod = fn->module;
+			pc = fn->entries[ins.c];
+			break;
+		}
+		case opcode::ret:
+			return regs[ins.a];
+		case opcode::ret_nothing:
+			return ctx.get_nothing();
+		case opcode::print:
+			wcout << regs[ins.a] << endl;
+			break;
+		case opcode::missing_arg:
+			throw runtime_error(L"unprovided call argument \"" + ctx.symbols.name(fn->node->params[ins.a]->id->id) + L"\" must have its default value");
+		case opcode::check_local:
+			if (regs[ins.a].undefined()) // Only if it is declared in a branch not taken
+				throw runtime_error(L"variable \"" + ctx.symbols.name(symbol(ins.target())) + L"\" not found");
+			break;
+		}
+	}
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "bytecode.h"
+#include "vm.h"
+
+namespace alanfl {
+	/*
+	 * The dispatch-loop interpreter for register bytecode, the second execution engine of AlanFL.
+	 * It works as part of a vm, sharing its globals and intrinsics,
+	 * and calls back to the vm for functions it has no code for.
+	 */
+	class interpreter {
+		static const std::size_t INITIAL_STACK = 1024;
+
+		vm &ctx;
+		std::vector<std::unique_ptr<bytecode_module>> modules; // Compiled modules, kept alive for closures
+		std::vector<value> stack; // The register stack, frames are windows into it
+
+		value run(const bytecode_function *fn, std::size_t base, std::uint32_t pc);
+		value call(std::size_t callee, unsigned argc);
+		const bytecode_function *enter(std::size_t callee, unsigned argc);
+	public:
+		explicit interpreter(vm &ctx) : ctx(ctx), stack(INITIAL_STACK) {}
+
+		/*
+		 * Compile and run a module, errors are reported the same way as vm::exec
+		 */
+		void exec(const std::shared_ptr<module_node> &node);
+	};
+}
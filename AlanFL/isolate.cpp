@@ -0,0 +1,82 @@
+#include <algorithm>
+#include "cache.h"
+#include "isolate.h"
+
+using namespace alanfl;
+using namespace std;
+
+shared_module::shared_module(const module_node &mod, const symbol_table &symbols)
+	: image(encode_module(mod, symbols)) {}
+
+shared_ptr<module_node> shared_module::instantiate(symbol_table &symbols) const {
+	auto ret = decode_module(image.data(), image.data() + image.size(), symbols);
+	if (ret == nullptr)
+		unreachable("shared module does not decode");
+	return ret;
+}
+
+isolate_pool::isolate_pool(unsigned threads, const vm_options &opts) : opts(opts) {
+	this->opts.profile.clear();
+	this->opts.line_counts = false;
+	if (threads == 0)
+		threads = max(1u, thread::hardware_concurrency());
+	workers.reserve(threads);
+	for (auto i = 0u; i < threads; i++)
+		workers.emplace_back([this] { work(); });
+}
+
+isolate_pool::~isolate_pool() {
+	{
+		lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	ready.notify_all();
+	for (auto &w : workers)
+		w.join();
+}
+
+future<shared_value> isolate_pool::submit(shared_ptr<const shared_module> mod, vector<shared_value> args) {
+	job j;
+	j.mod = move(mod);
+	j.args = move(args);
+	auto ret = j.result.get_future();
+	{
+		lock_guard<std::mutex> lock(mutex);
+		jobs.emplace_back(move(j));
+	}
+	ready.notify_one();
+	return ret;
+}
+
+void isolate_pool::work() {
+	shared_ptr<const shared_module> current; // Module of the last job, run by v as tree
+	shared_ptr<module_node> tree;
+	unique_ptr<vm> v;
+	for (;;) {
+		job j;
+		{
+			unique_lock<std::mutex> lock(mutex);
+			ready.wait(lock, [this] { return stopping || !jobs.empty(); });
+			if (jobs.empty())
+				return;
+			j = move(jobs.front());
+			jobs.pop_front();
+		}
+		try {
+			if (j.mod != current) {
+				current = nullptr;
+				tree = nullptr;
+				v.reset(new vm(opts));
+				tree = j.mod->instantiate(v->get_symbols());
+				current = j.mod;
+			}
+			vector<value> args;
+			args.reserve(j.args.size());
+			for (const auto &a : j.args)
+				args.emplace_back(v->import(a));
+			j.result.set_value(shared_value(v->run(tree, args.data(), args.size())));
+		} catch (...) {
+			j.result.set_exception(current_exception());
+		}
+	}
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "ast.h"
+#include "runtime.h"
+#include "vm.h"
+
+namespace alanfl {
+	/*
+	 * A parsed module that any number of threads can run at once.
+	 * Its nodes cannot be shared as they are: a vm threads handlers, type feedback, call caches
+	 * and machine code into them, and literals hold objects with plain reference counts.
+	 * So the module is frozen in the binary form of a cache file (see "cache.h"), which is only read,
+	 * and every vm running it decodes a tree of its own, interned into its own symbols.
+	 */
+	class shared_module {
+		std::string image;
+	public:
+		/*
+		 * Freeze a module parsed (and optimized, if so) with symbols
+		 */
+		shared_module(const module_node &mod, const symbol_table &symbols);
+
+		/*
+		 * A tree of the module for a vm, lexed as if with its symbols
+		 */
+		std::shared_ptr<module_node> instantiate(symbol_table &symbols) const;
+	};
+
+	/*
+	 * Worker threads running modules as isolates: every worker has a vm of its own, with its own
+	 * globals, objects, symbols and tree of the module, nothing but shared_module and shared_value
+	 * crosses threads. A job runs a module with vm::run and gives what entry returns,
+	 * or the runtime_error it throws, through a future.
+	 *
+	 * A worker keeps its vm and tree while it runs jobs of the same module, so the caches
+	 * and compiled code of the tree stay warm, a job of another module starts on a fresh vm.
+	 * Profiling and line counts are not supported, they are turned off in the options of the workers.
+	 */
+	class isolate_pool {
+		struct job {
+			std::shared_ptr<const shared_module> mod;
+			std::vector<shared_value> args;
+			std::promise<shared_value> result;
+		};
+
+		vm_options opts;
+		std::mutex mutex;
+		std::condition_variable ready; // Signalled when a job is queued or the pool stops
+		std::deque<job> jobs;
+		bool stopping = false;
+		std::vector<std::thread> workers;
+
+		void work();
+	public:
+		/*
+		 * Start the workers, as many as the hardware runs at once if threads is 0
+		 */
+		explicit isolate_pool(unsigned threads = 0, const vm_options &opts = vm_options());
+		isolate_pool(const isolate_pool&) = delete;
+		isolate_pool &operator=(const isolate_pool&) = delete;
+
+		/*
+		 * Jobs queued are run before the workers are joined
+		 */
+		~isolate_pool();
+
+		std::future<shared_value> submit(std::shared_ptr<const shared_module> mod, std::vector<shared_value> args = {});
+
+		unsigned size() const { return unsigned(workers.size()); }
+	};
+}
@@ -0,0 +1,931 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <functional>
+#include <initializer_list>
+#include <iostream>
+#include "jit.h"
+#include "vm.h"
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define JIT_X64
+#endif
+
+using namespace alanfl;
+using namespace std;
+
+/*
+ * Just enough of an x86-64 assembler for the code generator.
+ * Memory operands are always [base + displacement], jumps always take 32-bit offsets.
+ */
+class x64_assembler {
+public:
+	enum reg : uint8_t { rax, rcx, rdx, rbx, rsp, rbp, rsi, rdi, r8, r9, r10, r11, r12, r13, r14, r15 };
+	enum cond : uint8_t { o, no, b, ae, e, ne, be, a, s, ns, p, np, l, ge, le, g };
+	using label = size_t;
+private:
+	vector<uint8_t> code;
+	vector<ptrdiff_t> labels; // Where each label is bound, -1 if not yet
+	vector<pair<size_t, label>> fixups; // Offsets to patch once their labels are bound
+
+	void byte(const uint8_t x) { code.push_back(x); }
+	void dword(const uint32_t x) { for (auto i = 0; i < 4; i++) byte(uint8_t(x >> i * 8)); }
+	void qword(const uint64_t x) { for (auto i = 0; i < 8; i++) byte(uint8_t(x >> i * 8)); }
+
+	void rex(const bool w, const unsigned r, const unsigned b) {
+		const uint8_t prefix = 0x40 | w << 3 | (r >> 3 & 1) << 2 | (b >> 3 & 1);
+		if (prefix != 0x40)
+			byte(prefix);
+	}
+	void op_mem(const initializer_list<uint8_t> op, const bool w, const unsigned r, const reg base, const int32_t disp) {
+		rex(w, r, base);
+		for (auto x : op)
+			byte(x);
+		const auto short_disp = disp >= -128 && disp <= 127;
+		byte((short_disp ? 0x40 : 0x80) | (r & 7) << 3 | (base & 7));
+		if ((base & 7) == rsp) // rsp and r12 need a SIB byte
+			byte(0x24);
+		if (short_disp)
+			byte(uint8_t(disp));
+		else
+			dword(uint32_t(disp));
+	}
+	void op_reg(const initializer_list<uint8_t> op, const bool w, const unsigned r, const unsigned rm) {
+		rex(w, r, rm);
+		for (auto x : op)
+			byte(x);
+		byte(0xc0 | (r & 7) << 3 | (rm & 7));
+	}
+	void rel32(const label l) {
+		fixups.emplace_back(code.size(), l);
+		dword(0);
+	}
+public:
+	label make_label() { labels.push_back(-1); return labels.size() - 1; }
+	void bind(const label l) { labels[l] = ptrdiff_t(code.size()); }
+
+	void mov(const reg dst, const reg src) { op_reg({ 0x89 }, true, src, dst); }
+	void mov_imm(const reg dst, const uint64_t imm) {
+		rex(imm > 0xffffffff, 0, dst); // A 32-bit move clears the upper half
+		byte(0xb8 + (dst & 7));
+		if (imm > 0xffffffff)
+			qword(imm);
+		else
+			dword(uint32_t(imm));
+	}
+	void load(const reg dst, const reg base, const int32_t disp) { op_mem({ 0x8b }, true, dst, base, disp); }
+	void load32(const reg dst, const reg base, const int32_t disp) { op_mem({ 0x8b }, false, dst, base, disp); }
+	void load8(const reg dst, const reg base, const int32_t disp) { op_mem({ 0x0f, 0xb6 }, false, dst, base, disp); }
+	void store(const reg base, const int32_t disp, const reg src) { op_mem({ 0x89 }, true, src, base, disp); }
+	void store32_imm(const reg base, const int32_t disp, const uint32_t imm) { op_mem({ 0xc7 }, false, 0, base, disp); dword(imm); }
+	void cmp32_imm(const reg base, const int32_t disp, const uint32_t imm) { op_mem({ 0x81 }, false, 7, base, disp); dword(imm); }
+	void cmp8_imm(const reg base, const int32_t disp, const uint8_t imm) { op_mem({ 0x80 }, false, 7, base, disp); byte(imm); }
+	void lea(const reg dst, const reg base, const int32_t disp) { op_mem({ 0x8d }, true, dst, base, disp); }
+	void add(const reg dst, const reg base, const int32_t disp) { op_mem({ 0x03 }, true, dst, base, disp); }
+	void sub(const reg dst, const reg base, const int32_t disp) { op_mem({ 0x2b }, true, dst, base, disp); }
+	void imul(const reg dst, const reg base, const int32_t disp) { op_mem({ 0x0f, 0xaf }, true, dst, base, disp); }
+	void cmp(const reg lhs, const reg base, const int32_t disp) { op_mem({ 0x3b }, true, lhs, base, disp); }
+	void add(const reg dst, const reg src) { op_reg({ 0x01 }, true, src, dst); }
+	void cmp(const reg lhs, const reg rhs) { op_reg({ 0x39 }, true, rhs, lhs); }
+	void test(const reg lhs, const reg rhs) { op_reg({ 0x85 }, true, rhs, lhs); }
+	void test8(const reg r) { op_reg({ 0x84 }, false, r, r); } // Only al, cl, dl and bl
+	void and32(const reg dst, const reg src) { op_reg({ 0x21 }, false, src, dst); }
+	void or32(const reg dst, const reg src) { op_reg({ 0x09 }, false, src, dst); }
+	void xor32_imm(const reg dst, const uint8_t imm) { op_reg({ 0x83 }, false, 6, dst); byte(imm); }
+	void add_imm(const reg dst, const uint8_t imm) { op_reg({ 0x83 }, true, 0, dst); byte(imm); }
+	void sub_imm(const reg dst, const uint8_t imm) { op_reg({ 0x83 }, true, 5, dst); byte(imm); }
+	void neg(const reg r) { op_reg({ 0xf7 }, true, 3, r); }
+	void cqo() { byte(0x48); byte(0x99); }
+	void idiv(const reg r) { op_reg({ 0xf7 }, true, 7, r); }
+	void bt(const reg bits, const reg index) { op_reg({ 0x0f, 0xa3 }, false, index, bits); }
+	void setcc(const cond c, const reg r) { op_reg({ 0x0f, uint8_t(0x90 + c) }, false, 0, r); } // Only al, cl, dl and bl
+	void movzx8(const reg dst, const reg src) { op_reg({ 0x0f, 0xb6 }, false, dst, src); }
+	void push(const reg r) { rex(false, 0, r); byte(0x50 + (r & 7)); }
+	void pop(const reg r) { rex(false, 0, r); byte(0x58 + (r & 7)); }
+	void call(const void *fn) { mov_imm(rax, uint64_t(fn)); op_reg({ 0xff }, false, 2, rax); }
+	void ret() { byte(0xc3); }
+	void jmp(const label l) { byte(0xe9); rel32(l); }
+	void jcc(const cond c, const label l) { byte(0x0f); byte(0x80 + c); rel32(l); }
+
+	vector<uint8_t> finish() {
+		for (auto &f : fixups) {
+			const auto rel = uint32_t(labels[f.second] - ptrdiff_t(f.first + 4));
+			for (auto i = 0; i < 4; i++)
+				code[f.first + i] = uint8_t(rel >> i * 8);
+		}
+		return move(code);
+	}
+};
+
+using asm_reg = x64_assembler::reg;
+using asm_cond = x64_assembler::cond;
+
+// Registers taking the arguments of a call
+#ifdef _WIN32
+static const asm_reg ARGS[] = { x64_assembler::rcx, x64_assembler::rdx, x64_assembler::r8, x64_assembler::r9 };
+#else
+static const asm_reg ARGS[] = { x64_assembler::rdi, x64_assembler::rsi, x64_assembler::rdx, x64_assembler::rcx };
+#endif
+
+static const int JIT_ERROR = -1; // Returned by machine code when a callback failed
+
+// Types whose values hold a reference, see value::boxed()
+static const uint32_t BOXED_TYPES = 1u << unsigned(object_type::integer)
+	| 1u << unsigned(object_type::decimal) | 1u << unsigned(object_type::function);
+
+static_assert(sizeof(value) == 16, "the jit expects a value to take two words");
+
+/*
+ * Compiles a function into machine code, see "jit.h".
+ * rbx holds the vm and r12 the frame, a slot of the frame is addressed as [r12 + slot * 16].
+ * Slow paths are emitted after the body, out of the way of the fast ones.
+ */
+class jit::codegen : public ast_visitor<> {
+	struct unsupported {};
+
+	struct loop_state {
+		x64_assembler::label end;
+		size_t blocks; // Blocks entered when the loop starts
+	};
+
+	x64_assembler as;
+	fn_node *fn;
+	unsigned top = 1, temps = 1; // Temporaries taken and the most ever taken, the first one is for returns
+	x64_assembler::label epilogue, error;
+	vector<loop_state> loops;
+	vector<block_node*> blocks; // Blocks being compiled, their slots are cleared when they end
+	vector<function<void()>> cold; // Slow paths
+
+	/*
+	 * Compiles an expression into a given slot
+	 */
+	class expr_codegen : public ast_visitor<void, unsigned> {
+		codegen &gen;
+		void unexpected_visit() override { throw unsupported(); }
+
+		void visit_bool_node(bool_node *node, unsigned dest) override;
+		void visit_identifier_node(identifier_node *node, unsigned dest) override;
+		void visit_integer_node(integer_node *node, unsigned dest) override;
+		void visit_decimal_node(decimal_node *node, unsigned dest) override;
+		void visit_fn_node(fn_node *node, unsigned dest) override;
+		void visit_fn_call_node(fn_call_node *node, unsigned dest) override;
+		void visit_binop_node(binop_node *node, unsigned dest) override;
+		void visit_unop_node(unop_node *node, unsigned dest) override;
+	public:
+		explicit expr_codegen(codegen &gen) : gen(gen) {}
+	} ec;
+
+	static int32_t tag(const unsigned slot) { return int32_t(slot * sizeof(value) + offsetof(value, type)); }
+	static int32_t payload(const unsigned slot) { return int32_t(slot * sizeof(value) + offsetof(value, n_val)); }
+
+	unsigned temp();
+	void arg_ctx(int i) { as.mov(ARGS[i], x64_assembler::rbx); }
+	void arg_slot(int i, unsigned slot) { as.lea(ARGS[i], x64_assembler::r12, int32_t(slot * sizeof(value))); }
+	void arg_imm(int i, const void *p) { as.mov_imm(ARGS[i], uint64_t(p)); }
+	void call(const void *callback) { as.call(callback); }
+	void call_checked(const void *callback);
+	void leave(int code);
+
+	void store_imm(unsigned dest, object_type type, uint64_t val);
+	void store_result(unsigned dest, object_type type, x64_assembler::label slow);
+	void copy(unsigned dest, unsigned src);
+	unsigned local(identifier_node *node);
+	unsigned operand(expr_node *node, bool direct = true);
+	unsigned call_operands(fn_call_node *node);
+	void branch_false(expr_node *cond, const wchar_t *message, x64_assembler::label target);
+	void clear(const block_node *block);
+
+	void visit_empty_stmt_node(empty_stmt_node *node) override;
+	void visit_if_stmt_node(if_stmt_node *node) override;
+	void visit_while_stmt_node(while_stmt_node *node) override;
+	void visit_break_stmt_node(break_stmt_node *node) override;
+	void visit_return_stmt_node(return_stmt_node *node) override;
+	void visit_expr_stmt_node(expr_stmt_node *node) override;
+	void visit_var_decl_node(var_decl_node *node) override;
+	void visit_block_node(block_node *node) override;
+	void unexpected_visit() override { throw unsupported(); }
+public:
+	explicit codegen(fn_node *fn) : fn(fn), ec(*this) {}
+
+	/*
+	 * Machine code of the function, empty if it cannot be compiled
+	 */
+	vector<uint8_t> generate(unsigned &temps_taken);
+};
+
+unsigned jit::codegen::temp() {
+	temps = max(temps, top + 1);
+	return fn->slots + top++;
+}
+
+void jit::codegen::call_checked(const void *callback) {
+	call(callback);
+	as.test8(x64_assembler::rax);
+	as.jcc(x64_assembler::e, error);
+}
+
+/*
+ * Return from the machine code with a completion type
+ */
+void jit::codegen::leave(const int code) {
+	as.mov_imm(x64_assembler::rax, uint32_t(code));
+	as.jmp(epilogue);
+}
+
+/*
+ * Put an immediate into a slot, releasing what it held if boxed
+ */
+void jit::codegen::store_imm(const unsigned dest, const object_type type, const uint64_t val) {
+	const auto release = as.make_label(), back = as.make_label();
+	as.load32(x64_assembler::rcx, x64_assembler::r12, tag(dest));
+	as.mov_imm(x64_assembler::rdx, BOXED_TYPES);
+	as.bt(x64_assembler::rdx, x64_assembler::rcx);
+	as.jcc(x64_assembler::b, release);
+	as.bind(back);
+	as.store32_imm(x64_assembler::r12, tag(dest), uint32_t(type));
+	as.mov_imm(x64_assembler::rax, val);
+	as.store(x64_assembler::r12, payload(dest), x64_assembler::rax);
+	cold.emplace_back([=] {
+		as.bind(release);
+		arg_slot(0, dest);
+		call(reinterpret_cast<const void*>(&jit::clear));
+		as.jmp(back);
+	});
+}
+
+/*
+ * Put the immediate computed in rax into a slot, a boxed slot is left to the slow path
+ */
+void jit::codegen::store_result(const unsigned dest, const object_type type, const x64_assembler::label slow) {
+	as.load32(x64_assembler::rcx, x64_assembler::r12, tag(dest));
+	as.mov_imm(x64_assembler::rdx, BOXED_TYPES);
+	as.bt(x64_assembler::rdx, x64_assembler::rcx);
+	as.jcc(x64_assembler::b, slow);
+	as.store32_imm(x64_assembler::r12, tag(dest), uint32_t(type));
+	as.store(x64_assembler::r12, payload(dest), x64_assembler::rax);
+}
+
+/*
+ * Copy a slot into another, immediates are copied as two words, boxed values through value::operator=
+ */
+void jit::codegen::copy(const unsigned dest, const unsigned src) {
+	if (dest == src)
+		return;
+	const auto slow = as.make_label(), back = as.make_label();
+	as.load32(x64_assembler::rax, x64_assembler::r12, tag(src));
+	as.load32(x64_assembler::rcx, x64_assembler::r12, tag(dest));
+	as.mov_imm(x64_assembler::rdx, BOXED_TYPES);
+	as.bt(x64_assembler::rdx, x64_assembler::rax);
+	as.jcc(x64_assembler::b, slow);
+	as.bt(x64_assembler::rdx, x64_assembler::rcx);
+	as.jcc(x64_assembler::b, slow);
+	as.load(x64_assembler::rax, x64_assembler::r12, int32_t(src * sizeof(value)));
+	as.load(x64_assembler::rcx, x64_assembler::r12, int32_t(src * sizeof(value) + 8));
+	as.store(x64_assembler::r12, int32_t(dest * sizeof(value)), x64_assembler::rax);
+	as.store(x64_assembler::r12, int32_t(dest * sizeof(value) + 8), x64_assembler::rcx);
+	as.bind(back);
+	cold.emplace_back([=] {
+		as.bind(slow);
+		arg_slot(0, dest);
+		arg_slot(1, src);
+		call(reinterpret_cast<const void*>(&jit::assign));
+		as.jmp(back);
+	});
+}
+
+/*
+ * The slot of a local, checked to be defined like vm::get
+ */
+unsigned jit::codegen::local(identifier_node *node) {
+	const auto slot = node->addr.slot;
+	const auto undefined = as.make_label();
+	as.cmp32_imm(x64_assembler::r12, tag(slot), uint32_t(object_type::undefined));
+	as.jcc(x64_assembler::e, undefined);
+	cold.emplace_back([=] {
+		as.bind(undefined);
+		arg_ctx(0);
+		arg_imm(1, node);
+		call(reinterpret_cast<const void*>(&jit::undefined_local));
+		as.jmp(error);
+	});
+	return slot;
+}
+
+// Whether evaluating an expression may assign a local
+static bool assigns(expr_node *node) {
+	switch (node->type_id) {
+	case binop_node::TYPE_ID: {
+		const auto bin = static_cast<binop_node*>(node);
+		return bin->op == binary_op::assign || assigns(bin->lhs) || assigns(bin->rhs);
+	}
+	case unop_node::TYPE_ID:
+		return assigns(static_cast<unop_node*>(node)->operand);
+	case fn_call_node::TYPE_ID: {
+		const auto call = static_cast<fn_call_node*>(node);
+		return assigns(call->callee) || any_of(call->args.begin(), call->args.end(), assigns);
+	}
+	case fn_node::TYPE_ID:
+		return true; // Captures are evaluated in the frame
+	default:
+		return false;
+	}
+}
+
+/*
+ * The slot holding the value of an operand, a local is used where it is if 'direct'
+ * (which it must not be if it could be assigned before the operand is used)
+ */
+unsigned jit::codegen::operand(expr_node *node, const bool direct) {
+	if (direct && node->type_id == identifier_node::TYPE_ID && !static_cast<identifier_node*>(node)->addr.global())
+		return local(static_cast<identifier_node*>(node));
+	const auto t = temp();
+	ec.visit(node, t);
+	return t;
+}
+
+/*
+ * Evaluate the callee and arguments of a call in a row of temporaries, checked like vm::rvalue_evaluator::prepare_call
+ */
+unsigned jit::codegen::call_operands(fn_call_node *node) {
+	const auto callee = temp();
+	for (auto i = 0u; i < node->args.size(); i++)
+		temp();
+	ec.visit(node->callee, callee);
+	arg_ctx(0);
+	arg_slot(1, callee);
+	arg_imm(2, node);
+	call_checked(reinterpret_cast<const void*>(&jit::check_call));
+	for (auto i = 0u; i < node->args.size(); i++)
+		ec.visit(node->args[i], callee + 1 + i);
+	return callee;
+}
+
+/*
+ * Jump to target if a condition is false, it must be boolean
+ */
+void jit::codegen::branch_false(expr_node *cond, const wchar_t *message, const x64_assembler::label target) {
+	const auto mark = top;
+	const auto c = operand(cond);
+	const auto bad = as.make_label();
+	as.cmp32_imm(x64_assembler::r12, tag(c), uint32_t(object_type::boolean));
+	as.jcc(x64_assembler::ne, bad);
+	as.cmp8_imm(x64_assembler::r12, payload(c), 0);
+	as.jcc(x64_assembler::e, target);
+	cold.emplace_back([=] {
+		as.bind(bad);
+		arg_ctx(0);
+		arg_imm(1, message);
+		call(reinterpret_cast<const void*>(&jit::fail));
+		as.jmp(error);
+	});
+	top = mark;
+}
+
+void jit::codegen::clear(const block_node *block) {
+	for (auto i = 0u; i < block->slots; i++)
+		store_imm(block->base + i, object_type::undefined, 0);
+}
+
+void jit::codegen::visit_empty_stmt_node(empty_stmt_node *node) {}
+
+void jit::codegen::visit_if_stmt_node(if_stmt_node *node) {
+	const auto else_branch = as.make_label(), end = as.make_label();
+	branch_false(node->cond, L"condition for an if stmt must be boolean!", else_branch);
+	visit(node->branch);
+	if (node->else_branch != nullptr) {
+		as.jmp(end);
+		as.bind(else_branch);
+		visit(node->else_branch);
+		as.bind(end);
+	} else {
+		as.bind(else_branch);
+	}
+}
+
+void jit::codegen::visit_while_stmt_node(while_stmt_node *node) {
+	const auto cond = as.make_label(), end = as.make_label();
+	as.bind(cond);
+	branch_false(node->cond, L"condition for a while stmt must be boolean!", end);
+	loops.push_back({ end, blocks.size() });
+	visit(node->body);
+	loops.pop_back();
+	as.jmp(cond);
+	as.bind(end);
+}
+
+/*
+ * Blocks broken out of are cleared on the way, breaking out of the function is left to the vm to report
+ */
+void jit::codegen::visit_break_stmt_node(break_stmt_node *node) {
+	const auto cnt = max(node->cnt, 1u);
+	if (cnt > loops.size()) {
+		leave(completion::brk);
+		return;
+	}
+	const auto &loop = loops[loops.size() - cnt];
+	for (auto i = blocks.size(); i-- > loop.blocks; )
+		clear(blocks[i]);
+	as.jmp(loop.end);
+}
+
+void jit::codegen::visit_return_stmt_node(return_stmt_node *node) {
+	if (node->val->type_id == fn_call_node::TYPE_ID) { // Let the vm make the call in this frame
+		const auto mark = top;
+		const auto call = static_cast<fn_call_node*>(node->val);
+		const auto callee = call_operands(call);
+		arg_ctx(0);
+		arg_slot(1, callee);
+		arg_imm(2, call);
+		call_checked(reinterpret_cast<const void*>(&jit::tail_call));
+		leave(completion::tail);
+		top = mark;
+		return;
+	}
+	ec.visit(node->val, fn->slots);
+	leave(completion::ret);
+}
+
+void jit::codegen::visit_expr_stmt_node(expr_stmt_node *node) {
+	const auto mark = top;
+#ifdef EXPR_STMT_PRINT_RESULT
+	arg_slot(0, operand(node->expr));
+	call(reinterpret_cast<const void*>(&jit::print));
+#else
+	operand(node->expr);
+#endif
+	top = mark;
+}
+
+void jit::codegen::visit_var_decl_node(var_decl_node *node) {
+	for (auto &vi : node->vars) {
+		if (vi->init == nullptr) {
+			store_imm(vi->addr.slot, object_type::nothing, 0);
+			continue;
+		}
+		const auto mark = top;
+		const auto t = temp();
+		ec.visit(vi->init, t);
+		copy(vi->addr.slot, t);
+		top = mark;
+	}
+}
+
+void jit::codegen::visit_block_node(block_node *node) {
+	blocks.push_back(node);
+	for (auto &s : node->stmts)
+		visit(s);
+	blocks.pop_back();
+	clear(node);
+}
+
+void jit::codegen::expr_codegen::visit_bool_node(bool_node *node, const unsigned dest) {
+	gen.store_imm(dest, object_type::boolean, node->value);
+}
+
+void jit::codegen::expr_codegen::visit_integer_node(integer_node *node, const unsigned dest) {
+	if (node->value_obj.type == object_type::fixnum) {
+		gen.store_imm(dest, object_type::fixnum, uint64_t(node->value_obj.n_val));
+		return;
+	}
+	gen.arg_slot(0, dest);
+	gen.arg_imm(1, &node->value_obj);
+	gen.call(reinterpret_cast<const void*>(&jit::assign));
+}
+
+void jit::codegen::expr_codegen::visit_decimal_node(decimal_node *node, const unsigned dest) {
+	gen.arg_slot(0, dest);
+	gen.arg_imm(1, &node->value_obj);
+	gen.call(reinterpret_cast<const void*>(&jit::assign));
+}
+
+void jit::codegen::expr_codegen::visit_identifier_node(identifier_node *node, const unsigned dest) {
+	if (!node->addr.global()) {
+		gen.copy(dest, gen.local(node));
+		return;
+	}
+	gen.arg_ctx(0);
+	gen.as.mov_imm(ARGS[1], node->addr.slot);
+	gen.arg_slot(2, dest);
+	gen.call_checked(reinterpret_cast<const void*>(&jit::get_global));
+}
+
+void jit::codegen::expr_codegen::visit_fn_node(fn_node *node, const unsigned dest) {
+	gen.arg_ctx(0);
+	gen.arg_imm(1, node);
+	gen.arg_slot(2, dest);
+	gen.call_checked(reinterpret_cast<const void*>(&jit::closure));
+}
+
+void jit::codegen::expr_codegen::visit_fn_call_node(fn_call_node *node, const unsigned dest) {
+	const auto mark = gen.top;
+	const auto callee = gen.call_operands(node);
+	gen.arg_ctx(0);
+	gen.arg_slot(1, callee);
+	gen.arg_imm(2, node);
+	gen.arg_slot(3, dest);
+	gen.call_checked(reinterpret_cast<const void*>(&jit::call));
+	gen.top = mark;
+}
+
+// Whether an operator node has seen nothing but fixnums (or nothing at all) so far
+static bool seen_fixnum(const quick_op q) {
+	return q == quick_op::unseen || (q >= quick_op::add_fixnum && q <= quick_op::neq_fixnum) || q == quick_op::neg_fixnum;
+}
+
+static bool seen_boolean(const quick_op q) {
+	return q == quick_op::unseen || q == quick_op::land_boolean || q == quick_op::lor_boolean || q == quick_op::lnot_boolean;
+}
+
+/*
+ * Operators on fixnums and booleans are done inline when the node has seen them,
+ * with the operands checked and the result range checked, anything else goes to vm::binop
+ */
+void jit::codegen::expr_codegen::visit_binop_node(binop_node *node, const unsigned dest) {
+	auto &as = gen.as;
+	if (node->op == binary_op::assign) { // The value is evaluated before the variable is looked up
+		if (node->lhs->type_id != identifier_node::TYPE_ID)
+			throw unsupported(); // Not an lvalue, which the vm reports when it gets there
+		const auto id = static_cast<identifier_node*>(node->lhs);
+		visit(node->rhs, dest);
+		if (!id->addr.global()) {
+			gen.copy(gen.local(id), dest);
+			return;
+		}
+		gen.arg_ctx(0);
+		as.mov_imm(ARGS[1], id->addr.slot);
+		gen.arg_slot(2, dest);
+		gen.call_checked(reinterpret_cast<const void*>(&jit::set_global));
+		return;
+	}
+
+	const auto mark = gen.top;
+	const auto lhs = gen.operand(node->lhs, !assigns(node->rhs)), rhs = gen.operand(node->rhs);
+	const void *slow_path = nullptr;
+	switch (node->op) {
+#define BINOP_CALLBACK(op_enum) case op_enum: slow_path = reinterpret_cast<const void*>(&jit::binop<op_enum>); break;
+	BINOP_CALLBACK(binary_op::add)
+	BINOP_CALLBACK(binary_op::sub)
+	BINOP_CALLBACK(binary_op::mul)
+	BINOP_CALLBACK(binary_op::div)
+	BINOP_CALLBACK(binary_op::land)
+	BINOP_CALLBACK(binary_op::lor)
+	BINOP_CALLBACK(binary_op::lt)
+	BINOP_CALLBACK(binary_op::lteq)
+	BINOP_CALLBACK(binary_op::gt)
+	BINOP_CALLBACK(binary_op::gteq)
+	BINOP_CALLBACK(binary_op::eq)
+	BINOP_CALLBACK(binary_op::neq)
+#undef BINOP_CALLBACK
+	case binary_op::assign:
+		break;
+	}
+
+	const auto slow = as.make_label(), done = as.make_label();
+	auto fast = false;
+	const auto check_operands = [&](const object_type type) {
+		as.cmp32_imm(x64_assembler::r12, tag(lhs), uint32_t(type));
+		as.jcc(x64_assembler::ne, slow);
+		as.cmp32_imm(x64_assembler::r12, tag(rhs), uint32_t(type));
+		as.jcc(x64_assembler::ne, slow);
+	};
+	const auto check_range = [&] { // rax fits in a fixnum iff rax + FIXNUM_MAX <= 2 * FIXNUM_MAX unsigned
+		as.mov_imm(x64_assembler::rcx, uint64_t(FIXNUM_MAX));
+		as.mov(x64_assembler::rdx, x64_assembler::rax);
+		as.add(x64_assembler::rdx, x64_assembler::rcx);
+		as.add(x64_assembler::rcx, x64_assembler::rcx);
+		as.cmp(x64_assembler::rdx, x64_assembler::rcx);
+		as.jcc(x64_assembler::a, slow);
+	};
+	const auto compare = [&](const asm_cond c) {
+		check_operands(object_type::fixnum);
+		as.load(x64_assembler::rax, x64_assembler::r12, payload(lhs));
+		as.cmp(x64_assembler::rax, x64_assembler::r12, payload(rhs));
+		as.setcc(c, x64_assembler::rax);
+		as.movzx8(x64_assembler::rax, x64_assembler::rax);
+		gen.store_result(dest, object_type::boolean, slow);
+	};
+	const auto logical = [&](const bool is_and) {
+		check_operands(object_type::boolean);
+		as.load8(x64_assembler::rax, x64_assembler::r12, payload(lhs));
+		as.load8(x64_assembler::rcx, x64_assembler::r12, payload(rhs));
+		if (is_and)
+			as.and32(x64_assembler::rax, x64_assembler::rcx);
+		else
+			as.or32(x64_assembler::rax, x64_assembler::rcx);
+		gen.store_result(dest, object_type::boolean, slow);
+	};
+
+	if (seen_fixnum(node->quick)) {
+		fast = true;
+		switch (node->op) {
+		case binary_op::add:
+		case binary_op::sub:
+		case binary_op::mul:
+			check_operands(object_type::fixnum);
+			as.load(x64_assembler::rax, x64_assembler::r12, payload(lhs));
+			if (node->op == binary_op::add) {
+				as.add(x64_assembler::rax, x64_assembler::r12, payload(rhs));
+			} else if (node->op == binary_op::sub) {
+				as.sub(x64_assembler::rax, x64_assembler::r12, payload(rhs));
+			} else {
+				as.imul(x64_assembler::rax, x64_assembler::r12, payload(rhs));
+				as.jcc(x64_assembler::o, slow);
+			}
+			check_range();
+			gen.store_result(dest, object_type::fixnum, slow);
+			break;
+		case binary_op::div: // Division by zero is reported by vm::binop, the quotient always fits
+			check_operands(object_type::fixnum);
+			as.load(x64_assembler::rcx, x64_assembler::r12, payload(rhs));
+			as.test(x64_assembler::rcx, x64_assembler::rcx);
+			as.jcc(x64_assembler::e, slow);
+			as.load(x64_assembler::rax, x64_assembler::r12, payload(lhs));
+			as.cqo();
+			as.idiv(x64_assembler::rcx);
+			gen.store_result(dest, object_type::fixnum, slow);
+			break;
+		case binary_op::lt: compare(x64_assembler::l); break;
+		case binary_op::lteq: compare(x64_assembler::le); break;
+		case binary_op::gt: compare(x64_assembler::g); break;
+		case binary_op::gteq: compare(x64_assembler::ge); break;
+		case binary_op::eq: compare(x64_assembler::e); break;
+		case binary_op::neq: compare(x64_assembler::ne); break;
+		default: fast = false; break;
+		}
+	}
+	if (!fast && seen_boolean(node->quick) && (node->op == binary_op::land || node->op == binary_op::lor)) {
+		fast = true;
+		logical(node->op == binary_op::land);
+	}
+
+	if (fast) {
+		as.bind(done);
+		gen.cold.emplace_back([&gen = gen, slow, done, slow_path, lhs, rhs, dest] {
+			gen.as.bind(slow);
+			gen.arg_ctx(0);
+			gen.arg_slot(1, lhs);
+			gen.arg_slot(2, rhs);
+			gen.arg_slot(3, dest);
+			gen.call_checked(slow_path);
+			gen.as.jmp(done);
+		});
+	} else {
+		gen.arg_ctx(0);
+		gen.arg_slot(1, lhs);
+		gen.arg_slot(2, rhs);
+		gen.arg_slot(3, dest);
+		gen.call_checked(slow_path);
+	}
+	gen.top = mark;
+}
+
+void jit::codegen::expr_codegen::visit_unop_node(unop_node *node, const unsigned dest) {
+	auto &as = gen.as;
+	const auto mark = gen.top;
+	const auto val = gen.operand(node->operand);
+	const auto slow_path = node->op == unary_op::neg
+		? reinterpret_cast<const void*>(&jit::unop<unary_op::neg>)
+		: reinterpret_cast<const void*>(&jit::unop<unary_op::lnot>);
+	const auto slow = as.make_label(), done = as.make_label();
+	auto fast = false;
+	if (node->op == unary_op::neg && seen_fixnum(node->quick)) { // Fixnum range is symmetric
+		fast = true;
+		as.cmp32_imm(x64_assembler::r12, tag(val), uint32_t(object_type::fixnum));
+		as.jcc(x64_assembler::ne, slow);
+		as.load(x64_assembler::rax, x64_assembler::r12, payload(val));
+		as.neg(x64_assembler::rax);
+		gen.store_result(dest, object_type::fixnum, slow);
+	} else if (node->op == unary_op::lnot && seen_boolean(node->quick)) {
+		fast = true;
+		as.cmp32_imm(x64_assembler::r12, tag(val), uint32_t(object_type::boolean));
+		as.jcc(x64_assembler::ne, slow);
+		as.load8(x64_assembler::rax, x64_assembler::r12, payload(val));
+		as.xor32_imm(x64_assembler::rax, 1);
+		gen.store_result(dest, object_type::boolean, slow);
+	}
+
+	if (fast) {
+		as.bind(done);
+		gen.cold.emplace_back([&gen = gen, slow, done, slow_path, val, dest] {
+			gen.as.bind(slow);
+			gen.arg_ctx(0);
+			gen.arg_slot(1, val);
+			gen.arg_slot(2, dest);
+			gen.call_checked(slow_path);
+			gen.as.jmp(done);
+		});
+	} else {
+		gen.arg_ctx(0);
+		gen.arg_slot(1, val);
+		gen.arg_slot(2, dest);
+		gen.call_checked(slow_path);
+	}
+	gen.top = mark;
+}
+
+/*
+ * The code is entered as int (vm *ctx, value *frame), rbx and r12 are saved for them
+ * and the stack is kept 16-byte aligned (with home space for Windows) across callbacks
+ */
+vector<uint8_t> jit::codegen::generate(unsigned &temps_taken) {
+	epilogue = as.make_label(), error = as.make_label();
+	as.push(x64_assembler::rbp);
+	as.mov(x64_assembler::rbp, x64_assembler::rsp);
+	as.push(x64_assembler::rbx);
+	as.push(x64_assembler::r12);
+	as.sub_imm(x64_assembler::rsp, 32);
+	as.mov(x64_assembler::rbx, ARGS[0]);
+	as.mov(x64_assembler::r12, ARGS[1]);
+	try {
+		visit(fn->body);
+	} catch (unsupported&) {
+		return vector<uint8_t>();
+	}
+	leave(completion::normal);
+
+	as.bind(error);
+	as.mov_imm(x64_assembler::rax, uint32_t(JIT_ERROR));
+	as.bind(epilogue);
+	as.add_imm(x64_assembler::rsp, 32);
+	as.pop(x64_assembler::r12);
+	as.pop(x64_assembler::rbx);
+	as.pop(x64_assembler::rbp);
+	as.ret();
+	for (auto &path : cold)
+		path();
+	temps_taken = temps;
+	return as.finish();
+}
+
+/*
+ * Callbacks catch what they throw, it cannot unwind through machine code
+ */
+#define GUARDED(...) try { __VA_ARGS__; return true; } catch (...) { ctx->jit_engine->pending = current_exception(); return false; }
+
+void jit::assign(value *dst, const value *src) {
+	*dst = *src;
+}
+
+void jit::clear(value *val) {
+	*val = value();
+}
+
+void jit::print(const value *val) {
+	wcout << *val << endl;
+}
+
+bool jit::fail(vm *ctx, const wchar_t *message) {
+	GUARDED(throw runtime_error(message))
+}
+
+bool jit::undefined_local(vm *ctx, const identifier_node *node) {
+	GUARDED(ctx->get(*node))
+}
+
+bool jit::get_global(vm *ctx, const unsigned id, value *dst) {
+	GUARDED(*dst = ctx->get_global(id))
+}
+
+bool jit::set_global(vm *ctx, const unsigned id, const value *src) {
+	GUARDED(ctx->get_global(id) = *src)
+}
+
+template <binary_op op>
+bool jit::binop(vm *ctx, const value *lhs, const value *rhs, value *dst) {
+	GUARDED(*dst = ctx->binop(op, *lhs, *rhs))
+}
+
+template <unary_op op>
+bool jit::unop(vm *ctx, const value *val, value *dst) {
+	GUARDED(*dst = ctx->unop(op, *val))
+}
+
+bool jit::closure(vm *ctx, fn_node *node, value *dst) {
+	GUARDED(*dst = ctx->get_fn(node))
+}
+
+bool jit::check_call(vm *ctx, const value *callee, const fn_call_node *node) {
+	GUARDED(
+		const auto argc = node->args.size();
+		if (callee->type == object_type::native) {
+			if (argc != callee->nf_val->arity) // Let call_native() report it
+				ctx->call_native(*callee->nf_val, nullptr, argc);
+		} else if (callee->type != object_type::function) {
+			throw runtime_error(L"can not \"call\" a non-function object");
+		} else if (argc > callee->f_val().func->params.size()) {
+			throw runtime_error(L"too many arguments to call function");
+		}
+	)
+}
+
+/*
+ * A native is run right where its arguments are, unless profiling, where it goes through the vm like any call
+ */
+bool jit::call(vm *ctx, value *callee, fn_call_node *node, value *dst) {
+	GUARDED(
+		if (callee->type == object_type::native && ctx->prof == nullptr)
+			*dst = callee->nf_val->body(*ctx, callee + 1);
+		else
+			*dst = ctx->invoke(ctx->bind_call(node, callee));
+	)
+}
+
+bool jit::tail_call(vm *ctx, value *callee, fn_call_node *node) {
+	GUARDED(ctx->tail_call = ctx->bind_call(node, callee))
+}
+
+#undef GUARDED
+
+jit::~jit() {
+	for (auto &f : functions) {
+#ifdef _WIN32
+		VirtualFree(f->memory, 0, MEM_RELEASE);
+#else
+		munmap(f->memory, f->size);
+#endif
+	}
+}
+
+bool jit::available() {
+#ifdef JIT_X64
+	return true;
+#else
+	return false;
+#endif
+}
+
+/*
+ * Copy code into pages of its own, which are made executable (and no longer writable)
+ */
+void *jit::load(const vector<uint8_t> &code, size_t &size) {
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	const size_t page = info.dwPageSize;
+#else
+	const auto page = size_t(sysconf(_SC_PAGESIZE));
+#endif
+	size = (code.size() + page - 1) / page * page;
+#ifdef _WIN32
+	const auto p = VirtualAlloc(nullptr, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+	if (p == nullptr)
+		return nullptr;
+	memcpy(p, code.data(), code.size());
+	DWORD old;
+	if (!VirtualProtect(p, size, PAGE_EXECUTE_READ, &old)) {
+		VirtualFree(p, 0, MEM_RELEASE);
+		return nullptr;
+	}
+	FlushInstructionCache(GetCurrentProcess(), p, size);
+#else
+	const auto p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED)
+		return nullptr;
+	memcpy(p, code.data(), code.size());
+	if (mprotect(p, size, PROT_READ | PROT_EXEC) != 0) {
+		munmap(p, size);
+		return nullptr;
+	}
+#endif
+	return p;
+}
+
+const jit_function *jit::compile(fn_node *fn) {
+	if (!available())
+		return nullptr;
+	unsigned temps = 0;
+	const auto code = codegen(fn).generate(temps);
+	if (code.empty())
+		return nullptr;
+	auto ret = make_unique<jit_function>();
+	ret->slots = fn->slots;
+	ret->temps = temps;
+	ret->memory = load(code, ret->size);
+	if (ret->memory == nullptr)
+		return nullptr;
+	ret->entry = reinterpret_cast<jit_function::entry_point>(ret->memory);
+	functions.emplace_back(move(ret));
+	return functions.back().get();
+}
+
+completion jit::run(vm &ctx, const jit_function &code) {
+	const auto frame = ctx.stack.data() + ctx.frame_base;
+	ctx.push_frame(code.temps); // Right after the slots, popped with the frame
+	const auto c = code.entry(&ctx, frame);
+	if (c == JIT_ERROR) {
+		const auto e = pending;
+		pending = nullptr;
+		rethrow_exception(e);
+	}
+	if (c == completion::ret)
+		ctx.ret_val = move(frame[code.slots]);
+	return completion(completion::completion_type(c));
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+/*
+ * The baseline JIT of the tree-walker, compiling hot functions into x86-64 machine code.
+ *
+ * Compiled code runs in place of the body of a function, on the frame the vm set up for the call,
+ * so calls, default arguments and tail calls go through the vm as usual.
+ * Each node becomes a fixed sequence of instructions: fixnum and boolean operators are done inline
+ * (following the quickened variant of the node), anything else calls back into the runtime.
+ * Runtime errors cannot unwind through machine code, they are caught by the callback,
+ * kept in the jit, and rethrown once the machine code returns.
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <vector>
+#include "ast.h"
+
+namespace alanfl {
+	class vm;
+	struct completion;
+
+	/*
+	 * Machine code of a function, it returns how the body completes, see completion.
+	 * Temporaries of the code follow the slots of the frame, the first of them holds the value returned.
+	 */
+	struct jit_function {
+		using entry_point = int (*)(vm *ctx, value *frame);
+
+		entry_point entry = nullptr;
+		unsigned slots = 0, temps = 0;
+		void *memory = nullptr; // Executable pages holding the code
+		std::size_t size = 0;
+	};
+
+	class jit {
+		std::vector<std::unique_ptr<jit_function>> functions;
+		std::exception_ptr pending; // Error raised by a callback, rethrown when the machine code returns
+
+		class codegen;
+
+		/*
+		 * Callbacks from machine code, those returning bool return false on error
+		 */
+		static void assign(value *dst, const value *src);
+		static void clear(value *val);
+		static void print(const value *val);
+		static bool fail(vm *ctx, const wchar_t *message);
+		static bool undefined_local(vm *ctx, const identifier_node *node);
+		static bool get_global(vm *ctx, unsigned id, value *dst);
+		static bool set_global(vm *ctx, unsigned id, const value *src);
+		template <binary_op op> static bool binop(vm *ctx, const value *lhs, const value *rhs, value *dst);
+		template <unary_op op> static bool unop(vm *ctx, const value *val, value *dst);
+		static bool closure(vm *ctx, fn_node *node, value *dst);
+		static bool check_call(vm *ctx, const value *callee, const fn_call_node *node);
+		static bool call(vm *ctx, value *callee, fn_call_node *node, value *dst);
+		static bool tail_call(vm *ctx, value *callee, fn_call_node *node);
+
+		void *load(const std::vector<std::uint8_t> &code, std::size_t &size);
+	public:
+		jit() = default;
+		jit(const jit&) = delete;
+		jit &operator=(const jit&) = delete;
+		~jit();
+
+		/*
+		 * Whether machine code can be run on this platform at all
+		 */
+		static bool available();
+
+		/*
+		 * Compile a function whose body has been resolved, null if it uses anything the jit cannot compile
+		 */
+		const jit_function *compile(fn_node *fn);
+
+		/*
+		 * Run compiled code in the current frame of the vm, which is exactly the slots of the function
+		 */
+		completion run(vm &ctx, const jit_function &code);
+	};
+}
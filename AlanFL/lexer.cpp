@@ -1,6 +1,9 @@
 #include "lexer.h"
 
 #include <cctype>
+#include <climits>
+#include <cwchar>
+#include <iterator>
 #include "util.h"
 
 using namespace alanfl;
@@ -59,31 +62,105 @@ wostream& alanfl::operator<<(wostream& out, const token& t) {
 	return out << L'"' << t.text << L"\"(" << t.begin << L'-' << t.end << ")";
 }
 
-void lexer::consume_char(const bool append_to_text) {
-	input.get(ch);
+/*
+ * Decode one UTF-8 character, malformed bytes are decoded one by one as U+FFFD
+ */
+static const char *decode(const char *p, const char *end, char32_t &cp) {
+	const auto b = static_cast<unsigned char>(*p);
+	if (b < 0x80) {
+		cp = b;
+		return p + 1;
+	}
+	const auto len = b >= 0xf0 ? 4 : b >= 0xe0 ? 3 : b >= 0xc0 ? 2 : 0;
+	if (len == 0 || end - p < len) {
+		cp = 0xfffd;
+		return p + 1;
+	}
+	cp = b & (0x7f >> len);
+	for (auto i = 1; i < len; i++) {
+		const auto c = static_cast<unsigned char>(p[i]);
+		if ((c & 0xc0) != 0x80) {
+			cp = 0xfffd;
+			return p + 1;
+		}
+		cp = cp << 6 | (c & 0x3f);
+	}
+	return p + len;
+}
+
+/*
+ * Text of a span of the source, ASCII is simply widened
+ */
+static wstring widen(const char *p, const char *end) {
+	auto ascii = true;
+	for (auto q = p; q < end && ascii; q++)
+		ascii = static_cast<unsigned char>(*q) < 0x80;
+	if (ascii)
+		return wstring(p, end);
+	wstring ret;
+	ret.reserve(end - p);
+	while (p < end) {
+		char32_t cp;
+		p = decode(p, end, cp);
+		if (sizeof(wchar_t) == 2 && cp > 0xffff) { // UTF-16 needs a surrogate pair
+			cp -= 0x10000;
+			ret += wchar_t(0xd800 + (cp >> 10));
+			ret += wchar_t(0xdc00 + (cp & 0x3ff));
+		} else {
+			ret += wchar_t(cp);
+		}
+	}
+	return ret;
+}
+
+lexer::lexer(shared_ptr<source_buffer> src, symbol_table &symbols)
+	: src(move(src)), ch(0), loc(0, 0), begin_loc(loc), symbols(symbols) {
+	pos = ch_pos = begin_pos = this->src->begin();
+	if (this->src->end() - pos >= 3 && string(pos, 3) == "\xef\xbb\xbf") // Skip BOM
+		pos += 3;
+	consume_char();
+}
+
+lexer::lexer(wistream &input, symbol_table &symbols)
+	: lexer(make_shared<source_buffer>(to_str(wstring(istreambuf_iterator<wchar_t>(input), istreambuf_iterator<wchar_t>()))), symbols) {}
+
+void lexer::consume_char() {
+	ch_pos = pos;
+	if (pos == src->end()) {
+		at_eof = true;
+	} else if (static_cast<unsigned char>(*pos) < 0x80) {
+		ch = *pos++;
+	} else {
+		char32_t cp;
+		pos = decode(pos, src->end(), cp);
+		ch = cp <= WCHAR_MAX ? wchar_t(cp) : wchar_t(0xfffd);
+	}
 	if (ch == '\n')
 		loc.line++, loc.col = 1;
 	else
 		loc.col++;
-	if (append_to_text)
-		text += ch;
+	if (at_eof)
+		ch = 0;
 }
 
 void lexer::skip_whitespaces() {
 	while (ch == ' ' || ch == '\t' || ch == '\r' || ch == '\n')
-		consume_char(false);
+		consume_char();
 }
 
 void lexer::start_token() {
 	begin_loc = loc;
-	text.clear();
-	text += ch;
+	begin_pos = ch_pos;
 }
 
-token lexer::end_token(const token_type type) {
-	text.pop_back();
-	token ret = token(text, begin_loc, loc, type);
-	return ret;
+// Character classes, with a shortcut for ASCII
+static bool is_digit(const wchar_t ch) { return ch >= '0' && ch <= '9'; }
+static bool is_alpha(const wchar_t ch) {
+	return (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') || (ch >= 0x80 && iswalpha(ch));
+}
+
+token lexer::end_token(const token_type type) const {
+	return token(widen(begin_pos, ch_pos), begin_loc, loc, type);
 }
 
 #define SINGLE_CHAR_TOKEN(c, tok) \
@@ -105,22 +182,22 @@ token lexer::next_token() {
 	if (eof())
 		return end_token(token_type::eof);
 
-	if (iswdigit(ch)) {
-		while (iswdigit(ch))
+	if (is_digit(ch)) {
+		while (is_digit(ch))
 			consume_char();
 		if (ch == '.') {
 			consume_char();
-			while (iswdigit(ch))
+			while (is_digit(ch))
 				consume_char();
 			return end_token(token_type::decimal);
 		}
 		return end_token(token_type::integer);
 	}
 
-	if (iswalpha(ch)) {
-		while (iswalpha(ch) || iswdigit(ch) || ch == '_')
+	if (is_alpha(ch)) {
+		while (is_alpha(ch) || is_digit(ch) || ch == '_')
 			consume_char();
-		auto s = text; s.pop_back();
+		const auto s = widen(begin_pos, ch_pos);
 		KEYWORD_TOKEN(L"var", token_type::kw_var);
 		KEYWORD_TOKEN(L"true", token_type::kw_true);
 		KEYWORD_TOKEN(L"false", token_type::kw_false);
@@ -130,7 +207,9 @@ token lexer::next_token() {
 		KEYWORD_TOKEN(L"break", token_type::kw_break);
 		KEYWORD_TOKEN(L"fn", token_type::kw_fn);
 		KEYWORD_TOKEN(L"return", token_type::kw_return);
-		return end_token(token_type::identifier);
+		auto ret = token(s, begin_loc, loc, token_type::identifier);
+		ret.sym = symbols.intern(ret.text);
+		return ret;
 	}
 
 	DOUBLE_CHAR_TOKEN('+', '+', token_type::add, token_type::inc);
@@ -6,7 +6,10 @@
 
 #include <string>
 #include <iostream>
+#include <memory>
 #include <utility>
+#include "source.h"
+#include "symbol.h"
 
 namespace alanfl {
 	/*
@@ -74,6 +77,7 @@ namespace alanfl {
 		std::wstring text;
 		source_location begin, end;
 		token_type type;
+		symbol sym = 0; // Interned text, only for identifiers
 
 		token(std::wstring text, const source_location& start, const source_location& end, const token_type type)
 			: text(std::move(text)),
@@ -85,24 +89,27 @@ namespace alanfl {
 	};
 
 	/*
-	 * Hand-written lexer
+	 * Hand-written lexer, scanning UTF-8 source in memory
 	 */
 	class lexer {
-		void consume_char(bool append_to_text = true);
+		void consume_char();
 		void skip_whitespaces();
 		void start_token();
-		token end_token(token_type type);
+		token end_token(token_type type) const;
+		std::shared_ptr<source_buffer> src;
+		const char *pos; // Where the character after ch starts
+		const char *ch_pos; // Where ch starts
+		const char *begin_pos; // Where current token starts
 		wchar_t ch;
+		bool at_eof = false;
 		source_location loc; // Current location of lexer
 		source_location begin_loc; // Begin location of current token
-		std::wstring text;
+		symbol_table &symbols; // Where identifiers are interned
 	public:
-		std::wistream &input; // Hope this is fast enough, remember to manually toggle sync_with_stdio
-        bool eof() const { return input.eof(); }
-		
+		bool eof() const { return at_eof; }
+
 		token next_token();
-		explicit lexer(std::wistream &input) : ch(0), loc(0, 0), begin_loc(loc), text(L""), input(input) {
-			consume_char();
-		}
+		lexer(std::shared_ptr<source_buffer> src, symbol_table &symbols);
+		lexer(std::wistream &input, symbol_table &symbols); // Reads the whole stream first
 	};
 }
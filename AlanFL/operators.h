@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
 #include "lexer.h"
 
@@ -14,6 +15,20 @@ namespace alanfl {
 		neg, lnot
 	};
 
+	/*
+	 * Variants of operator nodes specialized for their operand types, an operator node is quickened
+	 * into the variant for the types it first sees, and becomes generic for good once they change
+	 */
+	enum class quick_op : std::uint8_t {
+		unseen, generic,
+		add_fixnum, sub_fixnum, mul_fixnum, div_fixnum,
+		lt_fixnum, lteq_fixnum, gt_fixnum, gteq_fixnum, eq_fixnum, neq_fixnum,
+		add_decimal, sub_decimal, mul_decimal, div_decimal,
+		lt_decimal, lteq_decimal, gt_decimal, gteq_decimal, eq_decimal, neq_decimal,
+		land_boolean, lor_boolean,
+		neg_fixnum, neg_decimal, lnot_boolean
+	};
+
 	std::wstring binop_str(binary_op op);
 
 	std::wstring unop_str(unary_op op);
@@ -0,0 +1,218 @@
+#include <algorithm>
+#include "optimizer.h"
+#include "resolver.h"
+#include "vm.h"
+
+using namespace alanfl;
+using namespace std;
+
+static bool is_literal(const expr_node *node) {
+	return node->type_id == bool_node::TYPE_ID
+		|| node->type_id == integer_node::TYPE_ID
+		|| node->type_id == decimal_node::TYPE_ID;
+}
+
+static value literal_value(const expr_node *node) {
+	switch (node->type_id) {
+	case bool_node::TYPE_ID: return value(static_cast<const bool_node*>(node)->value);
+	case integer_node::TYPE_ID: return static_cast<const integer_node*>(node)->value_obj;
+	case decimal_node::TYPE_ID: return static_cast<const decimal_node*>(node)->value_obj;
+	default: unreachable("not a literal");
+	}
+	return value();
+}
+
+void optimizer::optimize(module_node *node) {
+	resolver(ctx).resolve(node); // Globals are told from locals by their addresses
+	next_call.assign(node->decls.size() + 1, node->decls.size());
+	for (const auto p : { pass::scan, pass::collect, pass::propagate }) {
+		cur_pass = p;
+		visit(node);
+		if (p == pass::scan) // So far only declarations making calls are marked, with their own index
+			for (auto i = node->decls.size(); i-- > 0; )
+				next_call[i] = min(next_call[i], next_call[i + 1]);
+	}
+}
+
+void optimizer::fold(expr_node *&node) {
+	node = visit(node);
+}
+
+void optimizer::fold(stmt_node *node) {
+	visit(node);
+}
+
+/*
+ * A literal node holding a value computed at compile time, spanning the code it replaces.
+ * Returns nullptr for values that have no literal.
+ */
+expr_node *optimizer::literal(const value &val, const ast_node &at) const {
+	expr_node *ret;
+	switch (val.type) {
+	case object_type::boolean:
+		ret = arena.make<bool_node>(val.b_val);
+		break;
+	case object_type::fixnum:
+	case object_type::integer:
+		ret = arena.make<integer_node>(mpz_view(val).get());
+		break;
+	case object_type::decimal:
+		ret = arena.make<decimal_node>(val.d_val());
+		break;
+	default:
+		return nullptr;
+	}
+	ret->begin = at.begin, ret->end = at.end;
+	return ret;
+}
+
+expr_node *optimizer::copy_literal(const expr_node &lit, const ast_node &at) const {
+	return literal(literal_value(&lit), at);
+}
+
+expr_node *optimizer::visit_identifier_node(identifier_node *node) {
+	if (cur_pass == pass::scan || !node->addr.global())
+		return node;
+	const auto res = constants.find(node->addr.slot);
+	if (res == constants.end())
+		return node;
+	if (res->second.decl >= (fn_depth == 0 ? cur_decl : fn_limit)) // Maybe not initialized yet when this is evaluated
+		return node;
+	return copy_literal(*res->second.literal, *node);
+}
+
+expr_node *optimizer::visit_bool_node(bool_node *node) {
+	return node;
+}
+
+expr_node *optimizer::visit_integer_node(integer_node *node) {
+	return node;
+}
+
+expr_node *optimizer::visit_decimal_node(decimal_node *node) {
+	return node;
+}
+
+expr_node *optimizer::visit_binop_node(binop_node *node) {
+	if (node->op == binary_op::assign) {
+		const auto lhs = node->lhs;
+		if (cur_pass == pass::scan && lhs->type_id == identifier_node::TYPE_ID) {
+			const auto &addr = static_cast<identifier_node*>(lhs)->addr;
+			if (addr.global())
+				writes[addr.slot]++;
+		}
+		fold(node->rhs);
+		return node;
+	}
+	fold(node->lhs);
+	fold(node->rhs);
+	if (!is_literal(node->lhs) || !is_literal(node->rhs))
+		return node;
+	try {
+		const auto ret = literal(ctx.binop(node->op, literal_value(node->lhs), literal_value(node->rhs)), *node);
+		return ret != nullptr ? ret : node;
+	} catch (runtime_error&) {
+		return node; // Fails at runtime instead
+	}
+}
+
+expr_node *optimizer::visit_unop_node(unop_node *node) {
+	fold(node->operand);
+	if (!is_literal(node->operand))
+		return node;
+	try {
+		const auto ret = literal(ctx.unop(node->op, literal_value(node->operand)), *node);
+		return ret != nullptr ? ret : node;
+	} catch (runtime_error&) {
+		return node;
+	}
+}
+
+expr_node *optimizer::visit_fn_call_node(fn_call_node *node) {
+	if (cur_pass == pass::scan && fn_depth == 0)
+		next_call[cur_decl] = cur_decl;
+	fold(node->callee);
+	for (auto &arg : node->args)
+		fold(arg);
+	return node;
+}
+
+/*
+ * Captures are evaluated where the lambda is, default arguments and the body when it is called
+ */
+expr_node *optimizer::visit_fn_node(fn_node *node) {
+	if (cur_pass == pass::collect) // Only code run in order matters here
+		return node;
+	for (auto &vi : node->captures)
+		visit(vi);
+	if (fn_depth == 0)
+		fn_limit = next_call[cur_decl];
+	fn_depth++;
+	for (auto &vi : node->params)
+		visit(vi);
+	fold(node->body);
+	fn_depth--;
+	return node;
+}
+
+expr_node *optimizer::visit_empty_stmt_node(empty_stmt_node *node) {
+	return nullptr;
+}
+
+expr_node *optimizer::visit_expr_stmt_node(expr_stmt_node *node) {
+	fold(node->expr);
+	return nullptr;
+}
+
+expr_node *optimizer::visit_if_stmt_node(if_stmt_node *node) {
+	fold(node->cond);
+	fold(node->branch);
+	if (node->else_branch != nullptr)
+		fold(node->else_branch);
+	return nullptr;
+}
+
+expr_node *optimizer::visit_while_stmt_node(while_stmt_node *node) {
+	fold(node->cond);
+	fold(node->body);
+	return nullptr;
+}
+
+expr_node *optimizer::visit_break_stmt_node(break_stmt_node *node) {
+	return nullptr;
+}
+
+expr_node *optimizer::visit_return_stmt_node(return_stmt_node *node) {
+	fold(node->val);
+	return nullptr;
+}
+
+expr_node *optimizer::visit_block_node(block_node *node) {
+	for (auto &s : node->stmts)
+		fold(s);
+	return nullptr;
+}
+
+expr_node *optimizer::visit_var_decl_node(var_decl_node *node) {
+	for (auto &vi : node->vars)
+		visit(vi);
+	return nullptr;
+}
+
+expr_node *optimizer::visit_var_init_node(var_init_node *node) {
+	if (node->init != nullptr)
+		fold(node->init);
+	if (!node->addr.global())
+		return nullptr;
+	if (cur_pass == pass::scan)
+		writes[node->addr.slot]++;
+	else if (cur_pass == pass::collect && writes[node->addr.slot] == 1 && node->init != nullptr && is_literal(node->init))
+		constants[node->addr.slot] = { node->init, cur_decl };
+	return nullptr;
+}
+
+expr_node *optimizer::visit_module_node(module_node *node) {
+	for (cur_decl = 0; cur_decl < node->decls.size(); cur_decl++)
+		visit(node->decls[cur_decl]);
+	return nullptr;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <unordered_map>
+#include <vector>
+#include "ast.h"
+
+namespace alanfl {
+	/*
+	 * The optimizer rewrites a parsed module before it is run, it goes between parser::mod() and exec.
+	 *
+	 * Operators whose operands are all literals are folded into a literal node, with the same semantics
+	 * (and the same value_obj) as if the vm had computed them. An operation that would fail is left alone,
+	 * so that the error is still raised when, and only if, it is executed.
+	 *
+	 * A global declared once by the module, initialized to a constant and never assigned in it is propagated:
+	 * reads of it are replaced by its value and folded further. A read outside of any function only sees
+	 * those declared before it, as at runtime. A function made by a declaration may be called as soon as
+	 * a declaration from there on calls anything, so its body only sees those declared before that call.
+	 * A module is optimized on its own, a later module assigning one of its constant globals is not seen.
+	 */
+	class optimizer : public ast_visitor<expr_node*> {
+		enum class pass {
+			scan, // Fold, find globals assigned or declared more than once
+			collect, // Fold global initializers outside of functions in order, find constant globals
+			propagate // Replace reads of constant globals everywhere, fold again
+		};
+
+		// A constant global, the literal it is initialized to and the index of its declaration in the module
+		struct constant {
+			expr_node *literal;
+			std::size_t decl;
+		};
+
+		vm &ctx;
+		ast_arena &arena;
+		pass cur_pass = pass::scan;
+		unsigned fn_depth = 0; // Number of function bodies we are in
+		std::size_t cur_decl = 0; // Index of the module declaration being visited
+		std::vector<std::size_t> next_call; // The first declaration from each one on making calls outside of functions
+		std::size_t fn_limit = 0; // Constants seen by the function bodies being visited are declared before this one
+		std::unordered_map<unsigned, unsigned> writes; // Assignments and declarations of each global id
+		std::unordered_map<unsigned, constant> constants; // Constant globals by global id
+
+		void fold(expr_node *&node);
+		void fold(stmt_node *node);
+		expr_node *literal(const value &val, const ast_node &at) const;
+		expr_node *copy_literal(const expr_node &lit, const ast_node &at) const;
+
+		expr_node *visit_identifier_node(identifier_node *node) override;
+		expr_node *visit_bool_node(bool_node *node) override;
+		expr_node *visit_integer_node(integer_node *node) override;
+		expr_node *visit_decimal_node(decimal_node *node) override;
+		expr_node *visit_binop_node(binop_node *node) override;
+		expr_node *visit_unop_node(unop_node *node) override;
+		expr_node *visit_fn_call_node(fn_call_node *node) override;
+		expr_node *visit_fn_node(fn_node *node) override;
+
+		expr_node *visit_empty_stmt_node(empty_stmt_node *node) override;
+		expr_node *visit_expr_stmt_node(expr_stmt_node *node) override;
+		expr_node *visit_if_stmt_node(if_stmt_node *node) override;
+		expr_node *visit_while_stmt_node(while_stmt_node *node) override;
+		expr_node *visit_break_stmt_node(break_stmt_node *node) override;
+		expr_node *visit_return_stmt_node(return_stmt_node *node) override;
+		expr_node *visit_block_node(block_node *node) override;
+		expr_node *visit_var_decl_node(var_decl_node *node) override;
+		expr_node *visit_var_init_node(var_init_node *node) override;
+		expr_node *visit_module_node(module_node *node) override;
+	public:
+		/*
+		 * New literal nodes are allocated in the arena of the module
+		 */
+		optimizer(vm &ctx, ast_arena &arena) : ctx(ctx), arena(arena) {}
+
+		void optimize(module_node *node);
+	};
+}
@@ -0,0 +1,89 @@
+/*
+ * The engine parity check of AlanFL, run by ctest (see CMakeLists.txt)
+ *
+ * alanfl_parity script...
+ *
+ * Each script is run by the tree-walker as it is parsed, then by the other engines and with the optimizer,
+ * each time on a fresh vm and a fresh parse. What a run prints, errors included, must be the same
+ * as what the tree-walker prints without the optimizer. Every difference is reported,
+ * the exit status is 1 if there is any.
+ */
+
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+
+#include "interpreter.h"
+#include "lexer.h"
+#include "optimizer.h"
+#include "parser.h"
+#include "vm.h"
+
+using namespace std;
+using namespace alanfl;
+
+struct engine {
+	const char *name;
+	bool optimize, bytecode, jit;
+};
+
+static const engine engines[] = {
+	{ "tree", false, false, false },
+	{ "tree, optimized", true, false, false },
+	{ "bytecode", false, true, false },
+	{ "bytecode, optimized", true, true, false },
+	{ "jit, optimized", true, false, true },
+};
+
+/*
+ * What a script prints when run by an engine, false if it cannot be parsed
+ */
+static bool run(const string &path, const engine &e, wstring &out) {
+	vm_options opts;
+	opts.jit = e.jit;
+	vm v(opts);
+	const auto src = source_buffer::from_file(path);
+	if (src == nullptr)
+		return false;
+	auto par = make_shared<parser>(make_shared<lexer>(src, v.get_symbols()));
+	const auto mod = par->mod();
+	if (par->has_error())
+		return false;
+	if (e.optimize)
+		optimizer(v, *par->get_arena()).optimize(mod.get());
+	wostringstream captured;
+	const auto saved = wcout.rdbuf(captured.rdbuf());
+	if (e.bytecode)
+		interpreter(v).exec(mod);
+	else
+		v.exec(mod);
+	wcout.rdbuf(saved);
+	out = captured.str();
+	return true;
+}
+
+int main(int argc, char **argv) {
+	if (argc < 2) {
+		cerr << "usage: " << argv[0] << " script..." << endl;
+		return 1;
+	}
+	auto ok = true;
+	for (auto i = 1; i < argc; i++) {
+		wstring expected;
+		if (!run(argv[i], engines[0], expected)) {
+			cerr << argv[i] << ": cannot be parsed" << endl;
+			ok = false;
+			continue;
+		}
+		for (const auto &e : engines) {
+			wstring out;
+			if (!run(argv[i], e, out) || out != expected) {
+				cerr << argv[i] << ": " << e.name << " differs from the tree-walker" << endl;
+				wcerr << L"expected:\n" << expected << L"got:\n" << out;
+				ok = false;
+			}
+		}
+	}
+	return ok ? 0 : 1;
+}
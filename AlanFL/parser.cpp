@@ -13,7 +13,7 @@ using namespace std;
  * Just ENTER; at the start of the function, and use RETURN() instead of keyword return when we return
  */
 template <typename Ret>
-shared_ptr<Ret> locate(shared_ptr<Ret> node, source_location begin, source_location end) {
+Ret *locate(Ret *node, source_location begin, source_location end) {
 	node->begin = begin, node->end = end;
 	return node;
 }
@@ -62,25 +62,25 @@ void parser::dump_error() const {
  * &&
  * ||
  */
-shared_ptr<identifier_node> parser::identifier() {
+identifier_node *parser::identifier() {
 	ENTER;
-	const auto ret = make_shared<identifier_node>(tok.text);
+	const auto ret = arena->make<identifier_node>(tok.sym);
 	consume_token();
 	RETURN(ret);
 }
 
-shared_ptr<integer_node> parser::integer() {
+integer_node *parser::integer() {
 	ENTER;
 	const auto s = to_str(tok.text);
 	consume_token();
-	RETURN(make_shared<integer_node>(mpz_class(s)));
+	RETURN(arena->make<integer_node>(mpz_class(s)));
 }
 
-shared_ptr<decimal_node> parser::decimal() {
+decimal_node *parser::decimal() {
 	ENTER;
 	const auto s = to_str(tok.text);
 	consume_token();
-	RETURN(make_shared<decimal_node>(mpf_class(s)));
+	RETURN(arena->make<decimal_node>(mpf_class(s)));
 }
 
 /*
@@ -93,12 +93,12 @@ shared_ptr<decimal_node> parser::decimal() {
  * will ruin parsing since now its hard to recover using skip-until strategy!
  * TODO: Figure out a better strategy for error recovery!
  */
-shared_ptr<fn_node> parser::fn() {
+fn_node *parser::fn() {
 	ENTER;
 	if (!is(token_type::kw_fn))
 		error_unexpected(L"lambda function should start with 'fn'");
 	consume_token();
-	auto ret = make_shared<fn_node>();
+	auto ret = arena->make<fn_node>();
 	if (is(token_type::left_bracket)) {
 		consume_token();
 		if (!is(token_type::right_bracket)) {
@@ -129,7 +129,7 @@ shared_ptr<fn_node> parser::fn() {
 	RETURN(ret);
 }
 
-shared_ptr<expr_node> parser::primary() {
+expr_node *parser::primary() {
 	if (is(token_type::left_parenthesis)) {
 		ENTER;
 		consume_token();
@@ -150,23 +150,23 @@ shared_ptr<expr_node> parser::primary() {
 	if (is(token_type::kw_true)) {
 		ENTER;
 		consume_token();
-		RETURN(make_shared<bool_node>(true));
+		RETURN(arena->make<bool_node>(true));
 	}
 	if (is(token_type::kw_false)) {
 		ENTER;
 		consume_token();
-		RETURN(make_shared<bool_node>(false));
+		RETURN(arena->make<bool_node>(false));
 	}
 	
 	error_unexpected(L"expecting integer, decimal, identifier, true, false or '()' while parsing primary expression");
 }
 
-shared_ptr<expr_node> parser::expr_fn_call() {
+expr_node *parser::expr_fn_call() {
 	ENTER;
-	shared_ptr<expr_node> ret = primary();
+	expr_node *ret = primary();
 	while (is(token_type::left_parenthesis)) {
 		consume_token();
-		ret = make_shared<fn_call_node>(ret);
+		ret = arena->make<fn_call_node>(ret);
 		if (is(token_type::right_parenthesis)) {
 			consume_token();
 			continue;
@@ -174,7 +174,7 @@ shared_ptr<expr_node> parser::expr_fn_call() {
 		do {
 			if (is(token_type::comma))
 				consume_token();
-			static_pointer_cast<fn_call_node>(ret)->args.emplace_back(expr());
+			static_cast<fn_call_node*>(ret)->args.emplace_back(expr());
 		} while (is(token_type::comma));
 		if (is(token_type::right_parenthesis))
 			consume_token();
@@ -182,93 +182,93 @@ shared_ptr<expr_node> parser::expr_fn_call() {
 	RETURN(ret);
 }
 
-shared_ptr<expr_node> parser::expr_unop() {
+expr_node *parser::expr_unop() {
 	ENTER;
 	if (is(token_type::sub, token_type::lnot)) {
 		auto op = unop_from(tok.type);
 		consume_token();
-		return make_shared<unop_node>(expr_unop(), op);
+		return arena->make<unop_node>(expr_unop(), op);
 	}
 	RETURN(expr_fn_call());
 }
 
-shared_ptr<expr_node> parser::expr_mul_div() {
+expr_node *parser::expr_mul_div() {
 	ENTER;
 	auto ret = expr_unop();
 	while (is(token_type::mul, token_type::div)) {
 		auto op = binop_from(tok.type);
 		consume_token();
-		ret = make_shared<binop_node>(ret, expr_unop(), op);
+		ret = arena->make<binop_node>(ret, expr_unop(), op);
 	}
 	RETURN(ret);
 }
 
-shared_ptr<expr_node> parser::expr_add_sub() {
+expr_node *parser::expr_add_sub() {
 	ENTER;
 	auto ret = expr_mul_div();
 	while (is(token_type::add, token_type::sub)) {
 		auto op = binop_from(tok.type);
 		consume_token();
-		ret = make_shared<binop_node>(ret, expr_mul_div(), op);
+		ret = arena->make<binop_node>(ret, expr_mul_div(), op);
 	}
 	RETURN(ret);
 }
 
-shared_ptr<expr_node> parser::expr_assign() {
+expr_node *parser::expr_assign() {
 	ENTER;
 	auto ret = expr_add_sub();
 	if (is(token_type::assign)) {
 		consume_token();
-		ret = make_shared<binop_node>(ret, expr_assign(), binary_op::assign);
+		ret = arena->make<binop_node>(ret, expr_assign(), binary_op::assign);
 	}
 	RETURN(ret);
 }
 
-shared_ptr<expr_node> parser::expr_cmp() {
+expr_node *parser::expr_cmp() {
 	ENTER;
 	auto ret = expr_assign();
 	while (is(token_type::lt, token_type::lteq, token_type::gt, token_type::gteq)) {
 		auto op = binop_from(tok.type);
 		consume_token();
-		ret = make_shared<binop_node>(ret, expr_assign(), op);
+		ret = arena->make<binop_node>(ret, expr_assign(), op);
 	}
 	RETURN(ret);
 }
 
-shared_ptr<expr_node> parser::expr_eq_cmp() {
+expr_node *parser::expr_eq_cmp() {
 	ENTER;
 	auto ret = expr_cmp();
 	while (is(token_type::eq, token_type::neq)) {
 		auto op = binop_from(tok.type);
 		consume_token();
-		ret = make_shared<binop_node>(ret, expr_cmp(), op);
+		ret = arena->make<binop_node>(ret, expr_cmp(), op);
 	}
 	RETURN(ret);
 }
 
-shared_ptr<expr_node> parser::expr_and() {
+expr_node *parser::expr_and() {
 	ENTER;
 	auto ret = expr_eq_cmp();
 	while (is(token_type::land)) {
 		auto op = binop_from(tok.type);
 		consume_token();
-		ret = make_shared<binop_node>(ret, expr_eq_cmp(), op);
+		ret = arena->make<binop_node>(ret, expr_eq_cmp(), op);
 	}
 	RETURN(ret);
 }
 
-shared_ptr<expr_node> parser::expr_or() {
+expr_node *parser::expr_or() {
 	ENTER;
 	auto ret = expr_and();
 	while (is(token_type::lor)) {
 		auto op = binop_from(tok.type);
 		consume_token();
-		ret = make_shared<binop_node>(ret, expr_and(), op);
+		ret = arena->make<binop_node>(ret, expr_and(), op);
 	}
 	RETURN(ret);
 }
 
-shared_ptr<expr_node> parser::expr() {
+expr_node *parser::expr() {
 	return expr_or();
 }
 
@@ -285,11 +285,11 @@ shared_ptr<expr_node> parser::expr() {
  */
 #define COMMON_ERR_REC_TOKS token_type::kw_return, token_type::kw_break, token_type::kw_if, token_type::kw_else, token_type::kw_var, token_type::semicolon, token_type::right_brace
 
-shared_ptr<stmt_node> parser::expr_stmt() {
+stmt_node *parser::expr_stmt() {
 	ENTER;
-	shared_ptr<stmt_node> ret = nullptr;
+	stmt_node *ret = nullptr;
 	try {
-		ret = make_shared<expr_stmt_node>(expr());
+		ret = arena->make<expr_stmt_node>(expr());
 		if (!is(token_type::semicolon))
 			error_unexpected(L"expecting ';' after an expression statement");
 		consume_token();
@@ -298,12 +298,12 @@ shared_ptr<stmt_node> parser::expr_stmt() {
 		errors.emplace_back(e);
 		skip_until(COMMON_ERR_REC_TOKS);
 		if (ret == nullptr)
-			RETURN(make_shared<empty_stmt_node>());
+			RETURN(arena->make<empty_stmt_node>());
 		RETURN(ret);
 	}
 }
 
-shared_ptr<stmt_node> parser::if_stmt() {
+stmt_node *parser::if_stmt() {
 	ENTER;
 	try {
 		if (!is(token_type::kw_if))
@@ -311,18 +311,18 @@ shared_ptr<stmt_node> parser::if_stmt() {
 		consume_token();
 		auto cond = expr();
 		auto branch = stmt();
-		shared_ptr<stmt_node> else_branch = nullptr;
+		stmt_node *else_branch = nullptr;
 		if (is(token_type::kw_else))
 			consume_token(), else_branch = stmt();
-		RETURN(make_shared<if_stmt_node>(cond, branch, else_branch));
+		RETURN(arena->make<if_stmt_node>(cond, branch, else_branch));
 	} catch (parse_error &e) {
 		errors.emplace_back(e);
 		skip_until(COMMON_ERR_REC_TOKS);
-		RETURN(make_shared<empty_stmt_node>());
+		RETURN(arena->make<empty_stmt_node>());
 	}
 }
 
-shared_ptr<stmt_node> parser::while_stmt() {
+stmt_node *parser::while_stmt() {
 	ENTER;
 	try {
 		if (!is(token_type::kw_while))
@@ -330,17 +330,17 @@ shared_ptr<stmt_node> parser::while_stmt() {
 		consume_token();
 		auto cond = expr();
 		auto body = stmt();
-		RETURN(make_shared<while_stmt_node>(cond, body));
+		RETURN(arena->make<while_stmt_node>(cond, body));
 	} catch (parse_error &e) {
 		errors.emplace_back(e);
 		skip_until(COMMON_ERR_REC_TOKS);
-		RETURN(make_shared<empty_stmt_node>());
+		RETURN(arena->make<empty_stmt_node>());
 	}
 }
 
-shared_ptr<stmt_node> parser::break_stmt() {
+stmt_node *parser::break_stmt() {
 	ENTER;
-	shared_ptr<stmt_node> ret = nullptr;
+	stmt_node *ret = nullptr;
 	try {
 		if (!is(token_type::kw_break))
 			error_unexpected(L"expecting 'break' at the beginning of a break statement");
@@ -355,7 +355,7 @@ shared_ptr<stmt_node> parser::break_stmt() {
 			}
 			consume_token();
 		}
-		ret = make_shared<break_stmt_node>(cnt);
+		ret = arena->make<break_stmt_node>(cnt);
 		if (!is(token_type::semicolon))
 			error_unexpected(L"expecting ';' after a break statement");
 		consume_token();
@@ -364,19 +364,19 @@ shared_ptr<stmt_node> parser::break_stmt() {
 		errors.emplace_back(e);
 		skip_until(COMMON_ERR_REC_TOKS);
 		if (ret == nullptr)
-			RETURN(make_shared<empty_stmt_node>());
+			RETURN(arena->make<empty_stmt_node>());
 		RETURN(ret);
 	}
 }
 
-shared_ptr<stmt_node> parser::return_stmt() {
+stmt_node *parser::return_stmt() {
 	ENTER;
-	shared_ptr<stmt_node> ret = nullptr;
+	stmt_node *ret = nullptr;
 	try {
 		if (!is(token_type::kw_return))
 			error_unexpected(L"expecting 'return' at the beginning of a return statement");
 		consume_token();
-		ret = make_shared<return_stmt_node>(expr());
+		ret = arena->make<return_stmt_node>(expr());
 		if (!is(token_type::semicolon))
 			error_unexpected(L"expecting ';' after a return statement");
 		consume_token();
@@ -385,18 +385,18 @@ shared_ptr<stmt_node> parser::return_stmt() {
 		errors.emplace_back(e);
 		skip_until(COMMON_ERR_REC_TOKS);
 		if (ret == nullptr)
-			RETURN(make_shared<empty_stmt_node>());
+			RETURN(arena->make<empty_stmt_node>());
 		RETURN(ret);
 	}
 }
 
-shared_ptr<stmt_node> parser::block() {
+stmt_node *parser::block() {
 	ENTER;
 	try {
 		if (!is(token_type::left_brace))
 			error_unexpected(L"expecting '{' at the beginning of a code block");
 		consume_token();
-		auto ret = make_shared<block_node>();
+		auto ret = arena->make<block_node>();
 		while (!is(token_type::right_brace))
 			ret->stmts.emplace_back(stmt());
 		consume_token();
@@ -405,28 +405,28 @@ shared_ptr<stmt_node> parser::block() {
 		errors.emplace_back(e);
 		skip_until(token_type::right_brace);
 		consume_token();
-		RETURN(make_shared<empty_stmt_node>());
+		RETURN(arena->make<empty_stmt_node>());
 	}
 }
 
-shared_ptr<var_init_node> parser::var_init() {
+var_init_node *parser::var_init() {
 	ENTER;
 	auto id = identifier();
-	std::shared_ptr<expr_node> init = nullptr;
+	expr_node *init = nullptr;
 	if (is(token_type::assign)) {
 		consume_token();
 		init = expr();
 	}
-	RETURN(make_shared<var_init_node>(id, init));
+	RETURN(arena->make<var_init_node>(id, init));
 }
 
-shared_ptr<var_decl_node> parser::var_decl() {
+var_decl_node *parser::var_decl() {
 	ENTER;
 	try {
 		if (!is(token_type::kw_var))
 			error_unexpected(L"expecting 'var' at the beginning of variable declaration");
 		consume_token();
-		auto ret = make_shared<var_decl_node>();
+		auto ret = arena->make<var_decl_node>();
 		do {
 			if (is(token_type::comma))
 				consume_token();
@@ -439,15 +439,15 @@ shared_ptr<var_decl_node> parser::var_decl() {
 	} catch (parse_error &e) {
 		errors.emplace_back(e);
 		skip_until(COMMON_ERR_REC_TOKS);
-		RETURN(make_shared<var_decl_node>());
+		RETURN(arena->make<var_decl_node>());
 	}
 }
 
-shared_ptr<stmt_node> parser::stmt() {
+stmt_node *parser::stmt() {
 	if (is(token_type::semicolon)) {
 		ENTER;
 		consume_token();
-		RETURN(make_shared<empty_stmt_node>());
+		RETURN(arena->make<empty_stmt_node>());
 	}
 	if (is(token_type::left_brace))
 		return block();
@@ -469,7 +469,7 @@ shared_ptr<stmt_node> parser::stmt() {
  */
 shared_ptr<module_node> parser::mod() {
 	ENTER;
-	auto ret = make_shared<module_node>();
+	auto ret = arena->make<module_node>();
 	while (!eof()) {
 		try {
 			while (is(token_type::semicolon))
@@ -480,5 +480,6 @@ shared_ptr<module_node> parser::mod() {
 			skip_until(token_type::semicolon, token_type::kw_var);
 		}
 	}
-	RETURN(ret);
+	locate(ret, begin_loc, prev_end);
+	return shared_ptr<module_node>(arena, ret); // Holding the module keeps the whole tree alive
 }
\ No newline at end of file
@@ -24,6 +24,7 @@ namespace alanfl {
 	 */
 	class parser {
 		std::shared_ptr<lexer> lex; // The lexer where we receive tokens
+		std::shared_ptr<ast_arena> arena; // Where the parsed nodes live
 		token tok; // Current lookahead token
 		source_location prev_end; // End of previous token, useful when relating nodes to its covered code in file
 		std::vector<parse_error> errors; // Recoverable errors during parsing
@@ -49,41 +50,47 @@ namespace alanfl {
 		void error_unexpected(std::wstring msg) const;
 	public:
 		explicit parser(std::shared_ptr<lexer> lex)
-			: lex(std::move(lex)), tok(this->lex->next_token()) {}
+			: lex(std::move(lex)), arena(std::make_shared<ast_arena>()), tok(this->lex->next_token()) {}
 
 		bool eof() const { return tok.type == token_type::eof; }
 		bool has_error() const { return !errors.empty(); }
 		void dump_error() const;
 
+		/*
+		 * Nodes returned by the parsing functions are owned by the arena,
+		 * except mod() which shares the ownership of the arena with the parser
+		 */
+		const std::shared_ptr<ast_arena> &get_arena() const { return arena; }
+
 		/*
 		 * Parsing functions, each corresponds to a non-terminal
 		 */
-		std::shared_ptr<identifier_node> identifier();
-		std::shared_ptr<integer_node> integer();
-		std::shared_ptr<decimal_node> decimal();
+		identifier_node *identifier();
+		integer_node *integer();
+		decimal_node *decimal();
 
-		std::shared_ptr<fn_node> fn();
-		std::shared_ptr<expr_node> primary();
-		std::shared_ptr<expr_node> expr_fn_call();
-		std::shared_ptr<expr_node> expr_unop();
-		std::shared_ptr<expr_node> expr_mul_div();
-		std::shared_ptr<expr_node> expr_add_sub();
-		std::shared_ptr<expr_node> expr_assign();
-		std::shared_ptr<expr_node> expr_cmp();
-		std::shared_ptr<expr_node> expr_eq_cmp();
-		std::shared_ptr<expr_node> expr_and();
-		std::shared_ptr<expr_node> expr_or();
-		std::shared_ptr<expr_node> expr();
+		fn_node *fn();
+		expr_node *primary();
+		expr_node *expr_fn_call();
+		expr_node *expr_unop();
+		expr_node *expr_mul_div();
+		expr_node *expr_add_sub();
+		expr_node *expr_assign();
+		expr_node *expr_cmp();
+		expr_node *expr_eq_cmp();
+		expr_node *expr_and();
+		expr_node *expr_or();
+		expr_node *expr();
 
-		std::shared_ptr<stmt_node> expr_stmt();
-		std::shared_ptr<stmt_node> if_stmt();
-		std::shared_ptr<stmt_node> while_stmt();
-		std::shared_ptr<stmt_node> break_stmt();
-		std::shared_ptr<stmt_node> return_stmt();
-		std::shared_ptr<stmt_node> block();
-		std::shared_ptr<var_init_node> var_init();
-		std::shared_ptr<var_decl_node> var_decl();
-		std::shared_ptr<stmt_node> stmt();
+		stmt_node *expr_stmt();
+		stmt_node *if_stmt();
+		stmt_node *while_stmt();
+		stmt_node *break_stmt();
+		stmt_node *return_stmt();
+		stmt_node *block();
+		var_init_node *var_init();
+		var_decl_node *var_decl();
+		stmt_node *stmt();
 
 		std::shared_ptr<module_node> mod();
 	};
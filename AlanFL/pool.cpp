@@ -0,0 +1,91 @@
+#include <new>
+#include "pool.h"
+
+using namespace alanfl;
+using namespace std;
+
+object_pool::~object_pool() {
+	for (auto list : { &free_integers, &free_decimals, &free_functions })
+		for (auto obj : *list)
+			obj->~object();
+}
+
+void *object_pool::allocate(const size_t size) {
+	const auto cls = (size + GRANULE - 1) / GRANULE;
+	if (cls > SIZE_CLASSES)
+		return ::operator new(size);
+	auto &list = free_blocks[cls - 1];
+	if (!list.empty()) {
+		const auto p = list.back();
+		list.pop_back();
+		return p;
+	}
+	const auto block_size = cls * GRANULE;
+	if (cur == nullptr || cur + block_size > end) {
+		chunks.emplace_back(new char[CHUNK_SIZE]);
+		cur = chunks.back().get(), end = cur + CHUNK_SIZE;
+	}
+	const auto p = cur;
+	cur += block_size;
+	return p;
+}
+
+void object_pool::deallocate(void *p, const size_t size) {
+	const auto cls = (size + GRANULE - 1) / GRANULE;
+	if (cls > SIZE_CLASSES)
+		::operator delete(p);
+	else
+		free_blocks[cls - 1].emplace_back(p);
+}
+
+void object_pool::recycle(object *obj) {
+	switch (obj->type) {
+	case object_type::integer:
+		free_integers.emplace_back(obj);
+		break;
+	case object_type::decimal:
+		free_decimals.emplace_back(obj);
+		break;
+	case object_type::function: {
+		vector<value> captured;
+		captured.swap(obj->f_val.captured); // Captures may be recycled in turn, do it after we are on the list
+		obj->f_val.func = nullptr, obj->f_val.code = nullptr;
+		free_functions.emplace_back(obj);
+		break;
+	}
+	default:
+		obj->~object();
+		deallocate(obj, sizeof(object));
+		break;
+	}
+}
+
+object::ptr object_pool::wrap(object *obj) {
+	obj->pool = this;
+	return object::ptr(obj);
+}
+
+object::ptr object_pool::integer() {
+	if (free_integers.empty())
+		return wrap(new (allocate(sizeof(object))) object(mpz_class()));
+	const auto obj = free_integers.back();
+	free_integers.pop_back();
+	return wrap(obj);
+}
+
+object::ptr object_pool::decimal() {
+	if (free_decimals.empty())
+		return wrap(new (allocate(sizeof(object))) object(mpf_class()));
+	const auto obj = free_decimals.back();
+	free_decimals.pop_back();
+	return wrap(obj);
+}
+
+object::ptr object_pool::function(fn_node *func) {
+	if (free_functions.empty())
+		return wrap(new (allocate(sizeof(object))) object(fn_object(func)));
+	const auto obj = free_functions.back();
+	free_functions.pop_back();
+	obj->f_val.func = func;
+	return wrap(obj);
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+#include "runtime.h"
+
+namespace alanfl {
+	/*
+	 * The pool of boxed objects of a vm.
+	 * A dead object is not destroyed but kept on the free list of its type, so when it is reused
+	 * an integer or decimal is assigned into its old GMP storage instead of allocating new limbs.
+	 * Memory is carved from chunks and recycled by size class.
+	 * Objects from a pool must not outlive it.
+	 */
+	class object_pool {
+		static const std::size_t GRANULE = 16; // Size classes are multiples of this
+		static const std::size_t SIZE_CLASSES = 16; // Blocks larger than GRANULE * SIZE_CLASSES go to operator new
+		static const std::size_t CHUNK_SIZE = 64 * 1024;
+
+		std::vector<object*> free_integers, free_decimals, free_functions;
+		std::vector<void*> free_blocks[SIZE_CLASSES];
+		std::vector<std::unique_ptr<char[]>> chunks;
+		char *cur = nullptr, *end = nullptr; // Free space of the current chunk
+
+		object::ptr wrap(object *obj);
+	public:
+		object_pool() = default;
+		object_pool(const object_pool&) = delete;
+		object_pool &operator=(const object_pool&) = delete;
+		~object_pool();
+
+		void *allocate(std::size_t size);
+		void deallocate(void *p, std::size_t size);
+		void recycle(object *obj); // Takes back an object whose last reference died
+
+		/*
+		 * Fresh objects, numbers hold unspecified values and are expected to be assigned right away
+		 */
+		object::ptr integer();
+		object::ptr decimal();
+		object::ptr function(fn_node *func);
+	};
+}
@@ -0,0 +1,214 @@
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include "profiler.h"
+#include "util.h"
+
+using namespace alanfl;
+using namespace std;
+
+void profiler::add_module(const module_node *mod, const symbol_table &symbols) {
+	for (auto &decl : mod->decls)
+		for (auto &vi : decl->vars)
+			if (vi->init != nullptr && vi->init->type_id == fn_node::TYPE_ID)
+				names[static_cast<const fn_node*>(vi->init)] = symbols.name(vi->id->id);
+}
+
+unsigned profiler::function_id(const value &callee) {
+	const void *key = callee.type == object_type::native
+		? static_cast<const void*>(callee.nf_val)
+		: static_cast<const void*>(callee.f_val().func);
+	const auto res = ids.find(key);
+	if (res != ids.end())
+		return res->second;
+	function fn;
+	if (callee.type == object_type::native) {
+		fn.label = callee.nf_val->name;
+	} else {
+		const auto node = callee.f_val().func;
+		const auto name = names.find(node);
+		fn.label = (name == names.end() ? L"lambda" : name->second) + L'@' + to_wstr(node->begin);
+	}
+	functions.emplace_back(move(fn));
+	return ids[key] = unsigned(functions.size() - 1);
+}
+
+unsigned profiler::stack_id(const unsigned parent, const unsigned fn) {
+	const auto key = uint64_t(parent) << 32 | fn;
+	const auto res = children.find(key);
+	if (res != children.end())
+		return res->second;
+	call_stack s;
+	s.parent = parent, s.fn = fn;
+	stacks.emplace_back(s);
+	return children[key] = unsigned(stacks.size() - 1);
+}
+
+void profiler::enter(const value &callee) {
+	frame f;
+	f.fn = function_id(callee);
+	f.stack = stack_id(frames.empty() ? 0 : frames.back().stack, f.fn);
+	auto &fn = functions[f.fn];
+	fn.calls++;
+	fn.active++;
+	f.start = clock::now();
+	frames.emplace_back(f);
+}
+
+void profiler::leave() {
+	const auto now = clock::now();
+	const auto f = frames.back();
+	frames.pop_back();
+	const auto total = now - f.start, self = total - f.children;
+	auto &fn = functions[f.fn];
+	fn.exclusive += self;
+	if (--fn.active == 0) // The outermost call of a recursion covers the inner ones
+		fn.inclusive += total;
+	stacks[f.stack].exclusive += self;
+	if (!frames.empty())
+		frames.back().children += total;
+}
+
+void profiler::summary(wostream &out) const {
+	vector<unsigned> order(functions.size());
+	for (auto i = 0u; i < order.size(); i++)
+		order[i] = i;
+	sort(order.begin(), order.end(), [this](const unsigned a, const unsigned b) {
+		return functions[a].exclusive > functions[b].exclusive;
+	});
+	const auto ms = [](const clock::duration d) { return chrono::duration<double, milli>(d).count(); };
+	out << setw(12) << L"calls" << setw(16) << L"inclusive(ms)" << setw(16) << L"exclusive(ms)" << L"  function" << endl;
+	const auto flags = out.flags();
+	out << fixed << setprecision(3);
+	for (const auto i : order) {
+		const auto &fn = functions[i];
+		out << setw(12) << fn.calls << setw(16) << ms(fn.inclusive) << setw(16) << ms(fn.exclusive)
+			<< L"  " << fn.label << endl;
+	}
+	out.flags(flags);
+}
+
+bool profiler::write_folded(const string &path) const {
+	ofstream fout(path, ios::binary);
+	if (!fout)
+		return false;
+	for (auto i = 1u; i < stacks.size(); i++) {
+		const auto us = chrono::duration_cast<chrono::microseconds>(stacks[i].exclusive).count();
+		if (us == 0)
+			continue;
+		vector<unsigned> path_fns; // From the callee up to the root
+		for (auto s = i; s != 0; s = stacks[s].parent)
+			path_fns.emplace_back(stacks[s].fn);
+		string line;
+		for (auto it = path_fns.rbegin(); it != path_fns.rend(); ++it) {
+			if (!line.empty())
+				line += ';';
+			line += to_str(functions[*it].label);
+		}
+		fout << line << ' ' << us << '\n';
+	}
+	return bool(fout);
+}
+
+void line_counter::add_module(module_node *mod) {
+	for (auto &decl : mod->decls)
+		visit(decl);
+}
+
+void line_counter::visit_binop_node(binop_node *node) {
+	visit(node->lhs);
+	visit(node->rhs);
+}
+
+void line_counter::visit_unop_node(unop_node *node) {
+	visit(node->operand);
+}
+
+void line_counter::visit_fn_call_node(fn_call_node *node) {
+	visit(node->callee);
+	for (auto &arg : node->args)
+		visit(arg);
+}
+
+void line_counter::visit_fn_node(fn_node *node) {
+	for (auto &vi : node->captures)
+		visit(vi);
+	for (auto &vi : node->params)
+		visit(vi);
+	visit(node->body);
+}
+
+void line_counter::visit_empty_stmt_node(empty_stmt_node *node) {
+	hits[node];
+}
+
+void line_counter::visit_expr_stmt_node(expr_stmt_node *node) {
+	hits[node];
+	visit(node->expr);
+}
+
+void line_counter::visit_if_stmt_node(if_stmt_node *node) {
+	hits[node];
+	visit(node->cond);
+	visit(node->branch);
+	if (node->else_branch != nullptr)
+		visit(node->else_branch);
+}
+
+void line_counter::visit_while_stmt_node(while_stmt_node *node) {
+	hits[node];
+	visit(node->cond);
+	visit(node->body);
+}
+
+void line_counter::visit_break_stmt_node(break_stmt_node *node) {
+	hits[node];
+}
+
+void line_counter::visit_return_stmt_node(return_stmt_node *node) {
+	hits[node];
+	visit(node->val);
+}
+
+void line_counter::visit_block_node(block_node *node) {
+	for (auto &s : node->stmts)
+		visit(s);
+}
+
+void line_counter::visit_var_decl_node(var_decl_node *node) {
+	hits[node];
+	for (auto &vi : node->vars)
+		visit(vi);
+}
+
+void line_counter::visit_var_init_node(var_init_node *node) {
+	if (node->init != nullptr)
+		visit(node->init);
+}
+
+bool line_counter::annotate(const source_buffer &src, const string &path) const {
+	map<unsigned, uint64_t> lines; // Count of each line with a statement starting on it
+	for (const auto &h : hits) {
+		if (h.first->type_id == block_node::TYPE_ID)
+			continue;
+		auto &cnt = lines[h.first->begin.line];
+		cnt = max(cnt, h.second);
+	}
+	ofstream fout(path, ios::binary);
+	if (!fout)
+		return false;
+	auto line = 0u;
+	for (auto p = src.begin(); p != src.end(); line++) {
+		const auto eol = find(p, src.end(), '\n');
+		const auto res = lines.find(line);
+		string cnt = "-";
+		if (res != lines.end())
+			cnt = res->second == 0 ? "#####" : to_str(res->second);
+		fout << setw(10) << cnt << ':' << setw(6) << line + 1 << ':';
+		fout.write(p, eol - p);
+		fout << '\n';
+		p = eol == src.end() ? eol : eol + 1;
+	}
+	return bool(fout);
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "ast.h"
+#include "runtime.h"
+#include "source.h"
+
+namespace alanfl {
+	/*
+	 * The function-level profiler of the vm, on when vm_options::profile names a file.
+	 *
+	 * Every call the vm invokes is timed with a wall clock: call counts, inclusive time (counted once
+	 * for recursive calls) and exclusive time are kept per function, identified by its name and the
+	 * source location of its fn_node. A function bound by a global declaration is named after it,
+	 * other lambdas are just "lambda". A call in tail position replaces its caller on the profiled stack,
+	 * as it does in the frame.
+	 *
+	 * Exclusive time is also kept per call stack, written as folded stacks for flame graphs,
+	 * one "caller;callee microseconds" line per stack.
+	 */
+	class profiler {
+		using clock = std::chrono::steady_clock;
+
+		struct function {
+			std::wstring label; // name@line:col
+			std::uint64_t calls = 0;
+			clock::duration inclusive{}, exclusive{};
+			unsigned active = 0; // Calls of it on the stack
+		};
+
+		struct frame {
+			unsigned fn, stack; // The function and the call stack it ends
+			clock::time_point start;
+			clock::duration children{}; // Time spent in its callees
+		};
+
+		// A call stack is its caller stack plus one function, the root stack has no function
+		struct call_stack {
+			unsigned parent, fn;
+			clock::duration exclusive{};
+		};
+
+		std::vector<function> functions;
+		std::unordered_map<const void*, unsigned> ids; // Index of each fn_node or native_function
+		std::unordered_map<const fn_node*, std::wstring> names;
+		std::vector<call_stack> stacks;
+		std::unordered_map<std::uint64_t, unsigned> children; // Stack by its parent stack and function
+		std::vector<frame> frames; // Calls on the vm stack
+
+		unsigned function_id(const value &callee);
+		unsigned stack_id(unsigned parent, unsigned fn);
+	public:
+		profiler() : stacks(1) {}
+
+		/*
+		 * Name the functions bound by global declarations of a module
+		 */
+		void add_module(const module_node *mod, const symbol_table &symbols);
+
+		/*
+		 * A function or native is called, and the innermost call returns or throws
+		 */
+		void enter(const value &callee);
+		void leave();
+
+		/*
+		 * A summary of the functions by exclusive time, and folded stacks
+		 */
+		void summary(std::wostream &out) const;
+		bool write_folded(const std::string &path) const;
+	};
+
+	/*
+	 * Execution counts of statements, on when vm_options::line_counts is set.
+	 * Statement handlers count themselves only when they are threaded with a counter in the vm,
+	 * so statements cost nothing more without one. Blocks are not counted, only what they hold.
+	 *
+	 * The source is annotated line by line like gcov does: the count of the most run statement
+	 * starting on the line, "#####" if none of them has run, "-" if there is no statement.
+	 */
+	class line_counter : ast_visitor<> {
+		std::unordered_map<const stmt_node*, std::uint64_t> hits; // Every statement of the modules added
+
+		void visit_identifier_node(identifier_node *node) override {}
+		void visit_bool_node(bool_node *node) override {}
+		void visit_integer_node(integer_node *node) override {}
+		void visit_decimal_node(decimal_node *node) override {}
+		void visit_binop_node(binop_node *node) override;
+		void visit_unop_node(unop_node *node) override;
+		void visit_fn_call_node(fn_call_node *node) override;
+		void visit_fn_node(fn_node *node) override;
+
+		void visit_empty_stmt_node(empty_stmt_node *node) override;
+		void visit_expr_stmt_node(expr_stmt_node *node) override;
+		void visit_if_stmt_node(if_stmt_node *node) override;
+		void visit_while_stmt_node(while_stmt_node *node) override;
+		void visit_break_stmt_node(break_stmt_node *node) override;
+		void visit_return_stmt_node(return_stmt_node *node) override;
+		void visit_block_node(block_node *node) override;
+		void visit_var_decl_node(var_decl_node *node) override;
+		void visit_var_init_node(var_init_node *node) override;
+	public:
+		/*
+		 * Find the statements of a module, so that those never run are reported too
+		 */
+		void add_module(module_node *mod);
+
+		void hit(const stmt_node *node) { ++hits[node]; }
+
+		/*
+		 * Write the source the modules are parsed from, with the count of each line
+		 */
+		bool annotate(const source_buffer &src, const std::string &path) const;
+	};
+}
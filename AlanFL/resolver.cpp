@@ -0,0 +1,178 @@
+#include <algorithm>
+#include "resolver.h"
+#include "vm.h"
+
+using namespace alanfl;
+using namespace std;
+
+void resolver::resolve(ast_node *node) {
+	frames.clear();
+	frames.emplace_back(); // Code outside of any function, globals are initialized here
+	visit(node);
+}
+
+/*
+ * Declare a variable in the current scope, redeclaring a name in the same scope reuses its slot.
+ * Outside of any scope, it is a global.
+ */
+address resolver::declare(const symbol name) {
+	address ret;
+	auto &scopes = frames.back().scopes;
+	if (scopes.empty()) {
+		ret.slot = ctx.global_id(name);
+		return ret;
+	}
+	auto &s = scopes.back();
+	auto res = s.names.find(name);
+	ret.depth = unsigned(scopes.size() - 1);
+	if (res != s.names.end())
+		ret.slot = res->second;
+	else
+		ret.slot = s.names[name] = alloc();
+	return ret;
+}
+
+/*
+ * Take the next slot of the current scope
+ */
+unsigned resolver::alloc() {
+	auto &f = frames.back();
+	auto &s = f.scopes.back();
+	const auto slot = s.base + s.size++;
+	f.size = max(f.size, slot + 1);
+	return slot;
+}
+
+void resolver::push_scope() {
+	auto &scopes = frames.back().scopes;
+	scope_state s;
+	if (!scopes.empty())
+		s.base = scopes.back().base + scopes.back().size;
+	scopes.emplace_back(move(s));
+}
+
+unsigned resolver::pop_scope() {
+	const auto size = frames.back().scopes.back().size;
+	frames.back().scopes.pop_back();
+	return size;
+}
+
+void resolver::visit_identifier_node(identifier_node *node) {
+	auto &scopes = frames.back().scopes;
+	for (auto i = scopes.size(); i-- > 0; ) {
+		auto res = scopes[i].names.find(node->id);
+		if (res != scopes[i].names.end()) {
+			node->addr.depth = unsigned(i);
+			node->addr.slot = res->second;
+			return;
+		}
+	}
+	node->addr.depth = address::GLOBAL;
+	node->addr.slot = ctx.global_id(node->id);
+}
+
+void resolver::visit_bool_node(bool_node *node) {}
+
+void resolver::visit_integer_node(integer_node *node) {}
+
+void resolver::visit_decimal_node(decimal_node *node) {}
+
+void resolver::visit_binop_node(binop_node *node) {
+	visit(node->lhs);
+	visit(node->rhs);
+}
+
+void resolver::visit_unop_node(unop_node *node) {
+	visit(node->operand);
+}
+
+void resolver::visit_fn_call_node(fn_call_node *node) {
+	visit(node->callee);
+	for (auto &arg : node->args)
+		visit(arg);
+}
+
+/*
+ * Captures are evaluated in a temporary scope of the enclosing frame, each one sees the previous ones.
+ * Inside the lambda, the outermost scope holds captures first and then params,
+ * so a param hides a capture of the same name.
+ */
+void resolver::visit_fn_node(fn_node *node) {
+	push_scope();
+	for (auto &vi : node->captures) {
+		if (vi->init != nullptr)
+			visit(vi->init);
+		vi->addr.depth = unsigned(frames.back().scopes.size() - 1);
+		vi->addr.slot = alloc();
+		frames.back().scopes.back().names[vi->id->id] = vi->addr.slot;
+	}
+	pop_scope();
+
+	frames.emplace_back();
+	push_scope();
+	for (auto &vi : node->captures)
+		frames.back().scopes.back().names[vi->id->id] = alloc();
+	for (auto &vi : node->params) {
+		if (vi->init != nullptr)
+			visit(vi->init);
+		vi->addr.depth = 0;
+		vi->addr.slot = frames.back().scopes.back().names[vi->id->id] = alloc();
+	}
+	visit(node->body);
+	pop_scope();
+	node->slots = frames.back().size;
+	frames.pop_back();
+}
+
+void resolver::visit_empty_stmt_node(empty_stmt_node *node) {}
+
+void resolver::visit_expr_stmt_node(expr_stmt_node *node) {
+	visit(node->expr);
+}
+
+void resolver::visit_if_stmt_node(if_stmt_node *node) {
+	visit(node->cond);
+	visit(node->branch);
+	if (node->else_branch != nullptr)
+		visit(node->else_branch);
+}
+
+void resolver::visit_while_stmt_node(while_stmt_node *node) {
+	visit(node->cond);
+	visit(node->body);
+}
+
+void resolver::visit_break_stmt_node(break_stmt_node *node) {}
+
+void resolver::visit_return_stmt_node(return_stmt_node *node) {
+	visit(node->val);
+}
+
+void resolver::visit_block_node(block_node *node) {
+	push_scope();
+	node->base = frames.back().scopes.back().base;
+	for (auto &s : node->stmts)
+		visit(s);
+	node->slots = pop_scope();
+}
+
+void resolver::visit_var_decl_node(var_decl_node *node) {
+	for (auto &vi : node->vars)
+		visit(vi);
+}
+
+/*
+ * The initializer is resolved before the variable is declared,
+ * so it still sees whatever the name referred to
+ */
+void resolver::visit_var_init_node(var_init_node *node) {
+	if (node->init != nullptr)
+		visit(node->init);
+	node->addr = declare(node->id->id);
+}
+
+void resolver::visit_module_node(module_node *node) {
+	for (auto &decl : node->decls)
+		visit(decl);
+	node->slots = frames.back().size;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "ast.h"
+
+namespace alanfl {
+	/*
+	 * The resolver assigns each identifier and variable declaration an address before execution,
+	 * so that the vm reads variables by index instead of looking names up scope by scope.
+	 *
+	 * The scopes mirror what the vm does at runtime:
+	 * a call pushes a frame whose outermost scope holds captures and then params,
+	 * each block has a scope, and a lambda evaluates its captures in a temporary scope.
+	 * Scopes are laid out in the frame like a stack, so each variable gets a fixed slot of the frame.
+	 * A name is resolved to the innermost declaration visible at that point of its function,
+	 * functions cannot see locals of enclosing functions (only captures), so anything else is global.
+	 */
+	class resolver : public ast_visitor<> {
+		// A scope being resolved, frame slots of its variables, where they start and how many there are
+		struct scope_state {
+			std::unordered_map<symbol, unsigned> names;
+			unsigned base = 0, size = 0;
+		};
+
+		// A frame being resolved, a scope starts right after its enclosing one and is reused after it ends
+		struct frame_state {
+			std::vector<scope_state> scopes;
+			unsigned size = 0; // Slots the frame needs, the most its scopes ever take at once
+		};
+
+		vm &ctx;
+		std::vector<frame_state> frames; // Each function being resolved, back() is the current one
+
+		address declare(symbol name);
+		unsigned alloc();
+		void push_scope();
+		unsigned pop_scope();
+
+		void visit_identifier_node(identifier_node *node) override;
+		void visit_bool_node(bool_node *node) override;
+		void visit_integer_node(integer_node *node) override;
+		void visit_decimal_node(decimal_node *node) override;
+		void visit_binop_node(binop_node *node) override;
+		void visit_unop_node(unop_node *node) override;
+		void visit_fn_call_node(fn_call_node *node) override;
+		void visit_fn_node(fn_node *node) override;
+
+		void visit_empty_stmt_node(empty_stmt_node *node) override;
+		void visit_expr_stmt_node(expr_stmt_node *node) override;
+		void visit_if_stmt_node(if_stmt_node *node) override;
+		void visit_while_stmt_node(while_stmt_node *node) override;
+		void visit_break_stmt_node(break_stmt_node *node) override;
+		void visit_return_stmt_node(return_stmt_node *node) override;
+		void visit_block_node(block_node *node) override;
+		void visit_var_decl_node(var_decl_node *node) override;
+		void visit_var_init_node(var_init_node *node) override;
+		void visit_module_node(module_node *node) override;
+	public:
+		explicit resolver(vm &ctx) : ctx(ctx) {}
+
+		/*
+		 * Resolve a module, or a single lambda
+		 */
+		void resolve(ast_node *node);
+	};
+}
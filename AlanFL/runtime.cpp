@@ -1,3 +1,4 @@
+#include "pool.h"
 #include "runtime.h"
 #include "util.h"
 
@@ -14,62 +15,42 @@ object::~object() {
 	case object_type::decimal:
 		d_val.~mpf_class();
 		break;
-	case object_type::boolean:
+	case object_type::function:
+		f_val.~fn_object();
+		break;
 	default:
 		break; // Do nothing
 	}
 }
 
-bool scope::exists(const wstring &name) const {
-	return vars.find(name) != vars.end();
-}
-
-object::ptr_ref scope::get(const wstring &name) {
-	auto res = vars.find(name);
-	if (res == vars.end())
-		throw runtime_error(L"variable \"" + name + L"\" not found");
-	return res->second;
-}
-
-void scope::set(const wstring &name, const object::ptr &val) {
-	vars[name] = val;
-}
-
-bool frame::exists(const std::wstring &name) const {
-	for (auto it = scopes.rbegin(); it != scopes.rend(); ++it)
-		if (it->exists(name))
-			return true;
-	return false;
+void object::release() {
+	if (pool != nullptr)
+		pool->recycle(this);
+	else
+		delete this;
 }
 
-object::ptr_ref frame::get(const std::wstring &name) {
-	for (auto it = scopes.rbegin(); it != scopes.rend(); ++it) {
-		auto res = it->vars.find(name);
-		if (res != it->vars.end())
-			return res->second;
+shared_value::shared_value(const value &val) {
+	switch (val.type) {
+	case object_type::integer:
+		box = make_shared<const object>(val.i_val());
+		break;
+	case object_type::decimal:
+		box = make_shared<const object>(val.d_val());
+		break;
+	case object_type::function:
+		throw runtime_error(L"functions cannot be shared between threads");
+	default:
+		imm = val;
+		break;
 	}
-	throw runtime_error(L"variable \"" + name + L"\" not found");
 }
 
-void frame::set(const std::wstring &name, const object::ptr &val) {
-	for (auto it = scopes.rbegin(); it != scopes.rend(); ++it)
-		if (it->exists(name)) {
-			it->set(name, val);
-			return;
-		}
-	scopes.back().set(name, val);
-}
-
-void frame::push() {
-	scopes.emplace_back(ctx);
-}
-
-void frame::pop() {
-	scopes.pop_back();
-}
-
-scope &frame::top() const {
-	return const_cast<scope&>(scopes.back());
+value alanfl::make_integer(const mpz_class &z) {
+	fixnum n;
+	if (mpz_to_fixnum(z, n))
+		return value(n);
+	return value(object::ptr(new object(z)));
 }
 
 wostream & alanfl::operator<<(wostream & out, const object &obj) {
@@ -79,8 +60,23 @@ wostream & alanfl::operator<<(wostream & out, const object &obj) {
 		return out << to_wstr(obj.i_val.get_str());
 	case object_type::decimal:
 		return out << to_wstr(obj.d_val.get_str(expo).insert(expo, "."));
+	default:
+		break;
+	}
+	unreachable("printing object to wostream");
+	return out;
+}
+
+wostream & alanfl::operator<<(wostream & out, const value &val) {
+	switch (val.type) {
+	case object_type::fixnum:
+		return out << val.n_val;
 	case object_type::boolean:
-		return out << (obj.b_val ? "true" : "false");
+		return out << (val.b_val ? "true" : "false");
+	case object_type::integer:
+	case object_type::decimal:
+	case object_type::function:
+		return out << *val.box;
 	default:
 		break;
 	}
@@ -4,80 +4,206 @@
 #include <memory>
 #include <utility>
 #include <vector>
-#include "unordered_map"
+#include "fixnum.h"
+#include "symbol.h"
 
 namespace alanfl {
 	enum class object_type {
+		undefined, // Not a language value, the content of a variable not yet set
 		nothing,
-		integer,
+		fixnum, // An integer fitting in 63 bits
+		integer, // Any other integer
 		decimal,
 		boolean,
-		function
+		function,
+		native // A function implemented in C++
 	};
 
 	class vm;
 	struct fn_node;
+	struct bytecode_function;
+	struct object;
+	struct fn_object;
+	struct native_function;
+	class object_pool;
 
 	/*
-	 * The object in AlanFL, it is designed to be immutable. 
+	 * Handle to a boxed object, with the reference count kept in the object and updated non-atomically.
+	 * A vm and its objects are only used by one thread at a time, values cross threads as shared_value.
 	 */
-	struct object {
-		using ptr = std::shared_ptr<object>;
-		using ptr_ref = std::shared_ptr<object>&;
+	class object_ptr {
+		object *p = nullptr;
+	public:
+		object_ptr() = default;
+		object_ptr(std::nullptr_t) {}
+		explicit object_ptr(object *p);
+		object_ptr(const object_ptr &other);
+		object_ptr(object_ptr &&other) noexcept : p(other.p) { other.p = nullptr; }
+		object_ptr &operator=(object_ptr other) noexcept { std::swap(p, other.p); return *this; }
+		~object_ptr();
+
+		object *get() const { return p; }
+		object *operator->() const { return p; }
+		object &operator*() const { return *p; }
+		explicit operator bool() const { return p != nullptr; }
+	};
 
-		struct fn_object {
-			std::unordered_map<std::wstring, ptr> captured; // Captured variables
-			std::shared_ptr<fn_node> func; // Corresponding AST node
-			fn_object(std::shared_ptr<fn_node> func) : func(std::move(func)) {}
+	/*
+	 * A value in AlanFL, a tag followed by either an immediate or a boxed object.
+	 * Nothing, booleans, fixnums and natives are immediates, copying them never touches the heap.
+	 * A default constructed value is undefined.
+	 */
+	struct value {
+		object_type type;
+		union {
+			bool b_val;
+			fixnum n_val;
+			const native_function *nf_val;
+			object_ptr box;
 		};
 
+		value() : type(object_type::undefined), n_val(0) {}
+		explicit value(const bool b) : type(object_type::boolean), n_val(0) { b_val = b; }
+		explicit value(const fixnum n) : type(object_type::fixnum), n_val(n) {}
+		explicit value(const native_function *f) : type(object_type::native), n_val(0) { nf_val = f; }
+		explicit value(object_ptr obj);
+		static value nothing() { value ret; ret.type = object_type::nothing; return ret; }
+
+		value(const value &other) : type(other.type) {
+			if (other.boxed())
+				new (&box) object_ptr(other.box);
+			else
+				n_val = other.n_val;
+		}
+		value(value &&other) noexcept : type(other.type) {
+			if (other.boxed())
+				new (&box) object_ptr(std::move(other.box));
+			else
+				n_val = other.n_val;
+		}
+		value &operator=(const value &other) {
+			if (this != &other) {
+				this->~value();
+				new (this) value(other);
+			}
+			return *this;
+		}
+		value &operator=(value &&other) noexcept {
+			if (this != &other) {
+				this->~value();
+				new (this) value(std::move(other));
+			}
+			return *this;
+		}
+		~value() {
+			if (boxed())
+				box.~object_ptr();
+		}
+
+		bool boxed() const {
+			return type == object_type::integer || type == object_type::decimal || type == object_type::function;
+		}
+		bool undefined() const { return type == object_type::undefined; }
+		bool is_integer() const { return type == object_type::fixnum || type == object_type::integer; }
+
+		// Boxed contents, only valid with the corresponding type
+		const mpz_class &i_val() const;
+		const mpf_class &d_val() const;
+		fn_object &f_val() const;
+
+		friend std::wostream &operator<<(std::wostream &out, const value &val);
+	};
+
+	struct fn_object {
+		std::vector<value> captured; // Captured variables in the order of fn_node::captures, empty if none
+		fn_node *func; // Corresponding AST node
+		const bytecode_function *code = nullptr; // Compiled code, if created by the bytecode interpreter
+		fn_object(fn_node *func) : func(func) {}
+	};
+
+	/*
+	 * A function implemented in C++, kept in a static table and referred to by values as an immediate.
+	 * The arity is checked before the call, then the body gets the arguments where the caller put them.
+	 */
+	struct native_function {
+		const wchar_t *name;
+		unsigned arity; // Number of arguments taken, no defaults
+		value (*body)(vm &ctx, const value *args);
+	};
+
+	/*
+	 * Heap part of the values in AlanFL, only integers too large for a fixnum, decimals and functions
+	 * are boxed in an object. It is designed to be immutable.
+	 */
+	struct object {
+		using ptr = object_ptr;
+		using fn_object = alanfl::fn_object;
+
 		const object_type type;
+		unsigned refs = 0; // Number of object_ptrs to this object
+		object_pool *pool = nullptr; // Where it goes when it dies, deleted if null
 		union {
 			mpz_class i_val;
 			mpf_class d_val;
-			bool b_val;
 			fn_object f_val;
 		};
 
-		object() : type(object_type::nothing) {}
 		explicit object(mpz_class i) : type(object_type::integer), i_val(std::move(i)) {}
 		explicit object(mpf_class d) : type(object_type::decimal), d_val(std::move(d)) {}
-		explicit object(const bool b) : type(object_type::boolean), b_val(b) {}
 		explicit object(fn_object f) : type(object_type::function), f_val(std::move(f)) {}
 
 		~object();
 
+		void release(); // Called when the last reference dies
+
 		friend std::wostream &operator<<(std::wostream &out, const object &obj);
 	};
 
-	// A variable scope
-	struct scope {
-		const vm &ctx;
+	inline object_ptr::object_ptr(object *p) : p(p) { p->refs++; }
+	inline object_ptr::object_ptr(const object_ptr &other) : p(other.p) { if (p != nullptr) p->refs++; }
+	inline object_ptr::~object_ptr() { if (p != nullptr && --p->refs == 0) p->release(); }
 
-		std::unordered_map<std::wstring, object::ptr> vars;
-		bool exists(const std::wstring &name) const;
-		object::ptr_ref get(const std::wstring &name);
-		void set(const std::wstring &name, const object::ptr &val);
+	inline value::value(object::ptr obj) : type(obj->type), box(std::move(obj)) {}
+	inline const mpz_class &value::i_val() const { return box->i_val; }
+	inline const mpf_class &value::d_val() const { return box->d_val; }
+	inline fn_object &value::f_val() const { return box->f_val; }
 
-		scope(const vm &ctx) : ctx(ctx) {}
+	/*
+	 * A value detached from any vm, the only way for values to cross threads.
+	 * Boxed numbers are deep copied into an immutable object behind an atomic reference count,
+	 * and copied again into the pool of the vm importing it (see vm::import).
+	 * Functions cannot be shared since they refer to the code and captures of their vm, natives can.
+	 */
+	class shared_value {
+		value imm; // Immediates are copied as they are
+		std::shared_ptr<const object> box; // Or a private copy of the boxed number
+	public:
+		shared_value() = default;
+		explicit shared_value(const value &val);
+
+		object_type type() const { return box == nullptr ? imm.type : box->type; }
+		const value &immediate() const { return imm; }
+		const object &boxed() const { return *box; }
 	};
 
-	// An execution frame
-	struct frame {
-		const vm &ctx;
-
-		std::vector<scope> scopes;
-		bool exists(const std::wstring &name) const;
-		object::ptr_ref get(const std::wstring &name);
-		void set(const std::wstring &name, const object::ptr &val);
-		scope &top() const;
-
-		void push();
-		void pop();
-
-		frame(const vm &ctx) : ctx(ctx) {}
+	/*
+	 * An integer value seen as mpz_class, fixnums are converted into a temporary
+	 */
+	class mpz_view {
+		mpz_class tmp;
+		const mpz_class &ref;
+	public:
+		explicit mpz_view(const value &val)
+			: tmp(val.type == object_type::fixnum ? fixnum_to_mpz(val.n_val) : mpz_class()),
+			  ref(val.type == object_type::fixnum ? tmp : val.i_val()) {}
+		const mpz_class &get() const { return ref; }
 	};
 
+	/*
+	 * Make an integer value, as a fixnum if it fits
+	 */
+	value make_integer(const mpz_class &z);
+
 	// Though with the same name with std::runtime_error, this only be thrown when the VM runs into an error
 	struct runtime_error : std::exception {
 		std::wstring message;
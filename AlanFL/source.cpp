@@ -0,0 +1,71 @@
+#include <fstream>
+#include <iterator>
+#include "source.h"
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace alanfl;
+using namespace std;
+
+source_buffer::source_buffer(string text) : text(move(text)) {
+	first = this->text.data(), last = first + this->text.size();
+}
+
+source_buffer::~source_buffer() {
+	if (mapping == nullptr)
+		return;
+#ifdef _WIN32
+	UnmapViewOfFile(mapping);
+#else
+	munmap(mapping, mapped_size);
+#endif
+}
+
+shared_ptr<source_buffer> source_buffer::from_file(const string &path) {
+	shared_ptr<source_buffer> ret(new source_buffer());
+#ifdef _WIN32
+	const auto file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return nullptr;
+	LARGE_INTEGER size;
+	if (GetFileSizeEx(file, &size) && size.QuadPart > 0) {
+		const auto map = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (map != nullptr) {
+			ret->mapping = MapViewOfFile(map, FILE_MAP_READ, 0, 0, 0);
+			ret->mapped_size = size_t(size.QuadPart);
+			CloseHandle(map); // The view keeps the mapping alive
+		}
+	}
+	CloseHandle(file);
+#else
+	const auto fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return nullptr;
+	struct stat st;
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+		const auto p = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+		if (p != MAP_FAILED) {
+			ret->mapping = p;
+			ret->mapped_size = size_t(st.st_size);
+		}
+	}
+	close(fd);
+#endif
+	if (ret->mapping != nullptr) {
+		ret->first = static_cast<const char*>(ret->mapping);
+		ret->last = ret->first + ret->mapped_size;
+		return ret;
+	}
+	ifstream fin(path, ios::binary); // Empty, or not something we can map
+	if (!fin)
+		return nullptr;
+	return make_shared<source_buffer>(string(istreambuf_iterator<char>(fin), istreambuf_iterator<char>()));
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+namespace alanfl {
+	/*
+	 * Source code as UTF-8 bytes in memory, either mapped from a file or held in a string.
+	 * The lexer scans it directly, see "lexer.h".
+	 */
+	class source_buffer {
+		const char *first = nullptr, *last = nullptr;
+		std::string text; // Content when not mapped
+		void *mapping = nullptr; // Platform handle of the mapped view
+		std::size_t mapped_size = 0;
+
+		source_buffer() = default;
+	public:
+		explicit source_buffer(std::string text);
+		source_buffer(const source_buffer&) = delete;
+		source_buffer &operator=(const source_buffer&) = delete;
+		~source_buffer();
+
+		/*
+		 * Map a file into memory, or read it whole when it cannot be mapped, null if it cannot be opened
+		 */
+		static std::shared_ptr<source_buffer> from_file(const std::string &path);
+
+		const char *begin() const { return first; }
+		const char *end() const { return last; }
+	};
+}
@@ -0,0 +1,12 @@
+#include "symbol.h"
+
+using namespace alanfl;
+using namespace std;
+
+symbol symbol_table::intern(const wstring &name) {
+	const auto res = ids.find(name);
+	if (res != ids.end())
+		return res->second;
+	names.emplace_back(name);
+	return ids[name] = symbol(names.size() - 1);
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace alanfl {
+	/*
+	 * Names are interned once by the lexer, everything after it refers to a name by its symbol
+	 */
+	using symbol = std::uint32_t;
+
+	class symbol_table {
+		std::unordered_map<std::wstring, symbol> ids;
+		std::vector<std::wstring> names;
+	public:
+		symbol intern(const std::wstring &name);
+		const std::wstring &name(symbol sym) const { return names[sym]; }
+		std::size_t size() const { return names.size(); }
+	};
+}
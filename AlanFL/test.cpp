@@ -10,7 +10,10 @@
 
 #include <mpirxx.h>
 
+#include "cache.h"
+#include "interpreter.h"
 #include "lexer.h"
+#include "optimizer.h"
 #include "parser.h"
 #include "vm.h"
 #include <memory>
@@ -19,19 +22,44 @@ using namespace std;
 using namespace alanfl;
 
 void test_vm() {
-	vm v;
-	wifstream fin;
-	fin.open(LR"(D:\C++\AlanFL\Tests\test_phi.txt)");
-	auto lex = make_shared<lexer>(fin);
-	auto par = make_shared<parser>(lex);
-	const auto mod = par->mod();
-	
-	if (par->has_error()) {
-		wcout << "error in compilation, execution aborted" << endl;
-		par->dump_error();
-	} else
-		v.exec(mod);
-	fin.close();
+	vm_options opts;
+#ifdef VM_JIT
+	opts.jit = true;
+#endif
+	if (const auto profile = getenv("ALANFL_PROFILE")) // Where to write folded stacks, if profiling
+		opts.profile = profile;
+	const auto line_counts = getenv("ALANFL_LINE_COUNTS"); // Where to write the source annotated with counts
+	opts.line_counts = line_counts != nullptr;
+	vm v(opts);
+	const auto src = source_buffer::from_file(R"(D:\C++\AlanFL\Tests\test_phi.txt)");
+	if (src == nullptr) {
+		wcout << "cannot open source file" << endl;
+		return;
+	}
+	const auto cache_dir = getenv("ALANFL_CACHE"); // Where parsed modules are cached, if anywhere
+	shared_ptr<module_node> mod;
+	if (cache_dir != nullptr)
+		mod = module_cache(cache_dir).load(*src, v.get_symbols(), true);
+	if (mod == nullptr) {
+		auto lex = make_shared<lexer>(src, v.get_symbols());
+		auto par = make_shared<parser>(lex);
+		mod = par->mod();
+		if (par->has_error()) {
+			wcout << "error in compilation, execution aborted" << endl;
+			par->dump_error();
+			return;
+		}
+		optimizer(v, *par->get_arena()).optimize(mod.get());
+		if (cache_dir != nullptr)
+			module_cache(cache_dir).store(*src, *mod, v.get_symbols(), true);
+	}
+#ifdef EXEC_BYTECODE
+	interpreter(v).exec(mod);
+#else
+	v.exec(mod);
+#endif
+	if (line_counts != nullptr && !v.get_line_counts()->annotate(*src, line_counts))
+		wcout << "cannot write line counts" << endl;
 }
 
 int main() {
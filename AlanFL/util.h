@@ -7,6 +7,7 @@
 #include <string>
 #include <sstream>
 #include <codecvt>
+#include <locale>
 
 namespace alanfl {
 	/*
@@ -1,249 +1,422 @@
+#include <algorithm>
 #include <iostream>
-#include "parser.h"
+#include "resolver.h"
 #include "vm.h"
 
 using namespace alanfl;
 using namespace std;
 
-struct loop_break {
-	unsigned cnt;
-	explicit loop_break(const unsigned cnt) : cnt(cnt) {}
-};
-
-struct function_return {
-	object::ptr value;
-	explicit function_return(object::ptr value) : value(move(value)) {}
-};
-
-void vm::push_frame() {
-	call_stack.emplace(*this);
-	current_frame = &call_stack.top();
+/*
+ * Push a frame of undefined values on the top of the stack, returns where it starts
+ */
+size_t vm::push_frame(const unsigned size) {
+	const auto base = stack.size();
+	if (stack.capacity() - base < size) // Growing would move the stack under references to it
+		throw runtime_error(L"stack overflow");
+	stack.resize(base + size);
+	return base;
 }
 
-void vm::pop_frame() {
-	call_stack.pop();
-	if (!call_stack.empty())
-		current_frame = &call_stack.top();
+vm::call_depth::call_depth(vm &ctx) : ctx(ctx) {
+	if (ctx.depth == ctx.opts.max_depth)
+		throw runtime_error(L"stack overflow");
+	ctx.depth++;
 }
 
-void vm::init_obj_cache() {
-	for (auto i = MIN_CACHE_INT; i <= MAX_CACHE_INT; i++)
-		int_cache[i - MIN_CACHE_INT] = make_shared<object>(mpz_class(i));
-	bool_true = make_shared<object>(true);
-	bool_false = make_shared<object>(false);
-	nothing = make_shared<object>();
+void vm::clear_locals(const unsigned base, const unsigned size) {
+	fill_n(stack.begin() + frame_base + base, size, value());
 }
 
-void vm::init_intrinsics() {
-	push_frame();
-	global.set(L"print_line", get_intrinsic(L"fn (val)", [](vm &ctx) {
-		const auto val = ctx.get(L"val");
-		wcout << *val << endl;
-	}));
-	global.set(L"read_int", get_intrinsic(L"fn ()", [](vm &ctx) {
+const native_function vm::intrinsics[] = {
+	{ L"print_line", 1, [](vm &ctx, const value *args) {
+		wcout << args[0] << endl;
+		return ctx.get_nothing();
+	} },
+	{ L"read_int", 0, [](vm &ctx, const value *) {
 		string s; cin >> s;
-		throw function_return(ctx.get_int(mpz_class(s)));
-	}));
-	global.set(L"sqrt", get_intrinsic(L"fn (x)", [](vm &ctx) {
-		const auto x = ctx.get(L"x");
-		if (x->type != object_type::decimal && x->type != object_type::integer)
+		return ctx.get_int(mpz_class(s));
+	} },
+	{ L"sqrt", 1, [](vm &ctx, const value *args) {
+		const auto &x = args[0];
+		if (x.type != object_type::decimal && !x.is_integer())
 			throw runtime_error(L"sqrt accepts only numbers");
-		if (x->type == object_type::decimal)
-			throw function_return(ctx.get_decimal(sqrt(x->d_val)));
-		throw function_return(ctx.get_decimal(sqrt(x->i_val)));
-	}));
-	pop_frame();
+		if (x.type == object_type::decimal)
+			return ctx.get_decimal(sqrt(x.d_val()));
+		return ctx.get_decimal(sqrt(mpz_view(x).get()));
+	} },
+};
+
+void vm::init_intrinsics() {
+	for (const auto &fn : intrinsics)
+		set_global(fn.name, value(&fn));
 }
 
 void vm::exec(const shared_ptr<ast_node> &node) {
 	try {
-		visit(node);
+		trees.emplace_back(node);
+		resolver(*this).resolve(node.get());
+		if (prof != nullptr && node->type_id == module_node::TYPE_ID)
+			prof->add_module(static_cast<module_node*>(node.get()), symbols);
+		if (lines != nullptr && node->type_id == module_node::TYPE_ID)
+			lines->add_module(static_cast<module_node*>(node.get()));
+		visit(node.get());
 	} catch (runtime_error &re) {
 		wcout << re.message << endl;
 	} catch (logic_error &le) {
 		wcout << le.what() << endl;
 	}
+	pop_frame(0);
+	frame_base = 0;
+	if (prof != nullptr) {
+		prof->summary(wcout);
+		if (!prof->write_folded(opts.profile))
+			wcout << L"cannot write profile to " << to_wstr(opts.profile) << endl;
+	}
 }
 
-object::ptr_ref vm::get(const wstring &name) {
+value vm::run(const shared_ptr<module_node> &mod, const value *args, const size_t argc) {
+	if (any_of(trees.begin(), trees.end(), [&](const shared_ptr<const void> &t) { return t.get() == mod.get(); })) {
+		fill(globals.begin(), globals.end(), value()); // Run again from the start
+		init_intrinsics();
+	} else {
+		trees.emplace_back(mod);
+		resolver(*this).resolve(mod.get());
+		if (prof != nullptr)
+			prof->add_module(mod.get(), symbols);
+		if (lines != nullptr)
+			lines->add_module(mod.get());
+	}
 	try {
-		return current_frame->get(name);
+		auto ret = run_module(mod.get(), args, argc);
+		pop_frame(0);
+		frame_base = 0;
+		return ret;
 	} catch (...) {
-		return global.get(name);
+		pop_frame(0);
+		frame_base = 0;
+		throw;
 	}
 }
 
-object::ptr vm::get_nothing() const {
-	return nothing;
+/*
+ * Handlers are set on first execution, so nodes made after parsing (by the optimizer) need no extra pass.
+ * A vm counting statements threads handlers that count first.
+ */
+value alanfl::thread_expr(vm &ctx, expr_node *node) {
+#define EXPR_HANDLER(subtype) case subtype::TYPE_ID: \
+	node->handler = [](vm &ctx, expr_node *node) { return ctx.rve.visit_##subtype(static_cast<subtype*>(node)); }; \
+	break
+	switch (node->type_id) {
+	EXPR_HANDLER(bool_node);
+	EXPR_HANDLER(integer_node);
+	EXPR_HANDLER(decimal_node);
+	EXPR_HANDLER(identifier_node);
+	EXPR_HANDLER(binop_node);
+	EXPR_HANDLER(unop_node);
+	EXPR_HANDLER(fn_call_node);
+	EXPR_HANDLER(fn_node);
+	default: unreachable("unknown expression node");
+	}
+#undef EXPR_HANDLER
+	return node->handler(ctx, node);
+}
+
+completion alanfl::thread_stmt(vm &ctx, stmt_node *node) {
+#define STMT_HANDLER(subtype) case subtype::TYPE_ID: \
+	if (ctx.lines == nullptr) \
+		node->handler = [](vm &ctx, stmt_node *node) { return ctx.vm::visit_##subtype(static_cast<subtype*>(node)); }; \
+	else \
+		node->handler = [](vm &ctx, stmt_node *node) { ctx.lines->hit(node); return ctx.vm::visit_##subtype(static_cast<subtype*>(node)); }; \
+	break
+	switch (node->type_id) {
+	STMT_HANDLER(empty_stmt_node);
+	STMT_HANDLER(expr_stmt_node);
+	STMT_HANDLER(if_stmt_node);
+	STMT_HANDLER(while_stmt_node);
+	STMT_HANDLER(break_stmt_node);
+	STMT_HANDLER(return_stmt_node);
+	STMT_HANDLER(block_node);
+	STMT_HANDLER(var_decl_node);
+	default: unreachable("unknown statement node");
+	}
+#undef STMT_HANDLER
+	return node->handler(ctx, node);
 }
 
-object::ptr vm::get_int(mpz_class z) const {
-	if (z.fits_si_p()) {
-		const auto si = z.get_si();
-		if (-MIN_CACHE_INT <= si && si <= MAX_CACHE_INT)
-			return int_cache[si - MIN_CACHE_INT];
-	}
-	return make_shared<object>(move(z));
+value &vm::get(const identifier_node &node) {
+	if (node.addr.global())
+		return get_global(node.addr.slot);
+	auto &val = local(node.addr.slot);
+	if (val.undefined()) // Only if it is declared in a branch not taken
+		throw runtime_error(L"variable \"" + symbols.name(node.id) + L"\" not found");
+	return val;
 }
 
-object::ptr vm::get_decimal(mpf_class f) const {
-	return make_shared<object>(move(f));
+unsigned vm::global_id(const symbol name) {
+	if (name >= global_ids.size())
+		global_ids.resize(symbols.size(), unsigned(NO_GLOBAL));
+	if (global_ids[name] != NO_GLOBAL)
+		return global_ids[name];
+	globals.emplace_back();
+	global_names.emplace_back(name);
+	return global_ids[name] = unsigned(globals.size() - 1);
 }
 
-object::ptr vm::get_bool(const bool b) const {
-	return b ? bool_true : bool_false;
+value &vm::get_global(const unsigned id) {
+	auto &val = globals[id];
+	if (val.undefined())
+		throw runtime_error(L"variable \"" + symbols.name(global_names[id]) + L"\" not found");
+	return val;
 }
 
-object::ptr vm::get_fn(const shared_ptr<fn_node> &fn) {
-	current_frame->push();
-	for (auto &vi : fn->captures)
-		visit(vi);
-	auto &cap = current_frame->top();
-	auto ret = make_shared<object>(object::fn_object(fn));
-	ret->f_val.captured = move(cap.vars);
-	current_frame->pop();
-	return ret;
+void vm::set_global(const wstring &name, const value &val) {
+	globals[global_id(name)] = val;
 }
 
-object::ptr vm::get_intrinsic(const wstring &sig, function<void(vm &ctx)> body) {
-	wstringstream wss; wss << sig << L" {}";
-	auto lex = make_shared<lexer>(wss);
-	auto par = make_shared<parser>(lex);
-	auto fn = par->fn();
-	fn->body = make_shared<intrinsic_node>(body);
-	return get_fn(fn);
+value vm::get_nothing() const {
+	return value::nothing();
 }
 
-void vm::visit_empty_stmt_node(const shared_ptr<empty_stmt_node> &node) {}
+value vm::get_int(mpz_class z) const {
+	fixnum n;
+	if (mpz_to_fixnum(z, n))
+		return get_fixnum(n);
+	auto obj = pool.integer();
+	obj->i_val = move(z);
+	return value(move(obj));
+}
 
-void vm::visit_if_stmt_node(const shared_ptr<if_stmt_node> &node) {
-	const auto cond = rve.visit(node->cond);
-	if (cond->type != object_type::boolean)
-		throw runtime_error(L"condition for an if stmt must be boolean!");
-	if (cond->b_val)
-		visit(node->branch);
-	else if (node->else_branch != nullptr)
-		visit(node->else_branch);
+value vm::get_int(object::ptr obj) const {
+	fixnum n;
+	if (mpz_to_fixnum(obj->i_val, n))
+		return get_fixnum(n);
+	return value(move(obj));
 }
 
-void vm::visit_while_stmt_node(const shared_ptr<while_stmt_node> &node) {
-	auto cond = rve.visit(node->cond);
-	if (cond->type != object_type::boolean)
-		throw runtime_error(L"condition for a while stmt must be boolean!");
+value vm::get_fixnum(const fixnum n) const {
+	return value(n);
+}
+
+value vm::get_decimal(mpf_class f) const {
+	auto obj = pool.decimal();
+	obj->d_val = move(f);
+	return value(move(obj));
+}
+
+value vm::get_bool(const bool b) const {
+	return value(b);
+}
+
+/*
+ * Captures are evaluated in a temporary scope of the current frame, then moved into the closure
+ */
+value vm::get_fn(fn_node *fn) {
+	auto ret = value(pool.function(fn));
+	if (fn->captures.empty())
+		return ret;
+	const auto base = fn->captures.front()->addr.slot, size = unsigned(fn->captures.size());
 	try {
-		while (cond->b_val) {
-			visit(node->body);
-			cond = rve.visit(node->cond);
-			if (cond->type != object_type::boolean)
-				throw runtime_error(L"condition for a while stmt must be boolean!");
-		}
-	} catch (loop_break &lb) {
-		if (lb.cnt > 1) {
-			lb.cnt--;
-			throw;
-		}
+		for (auto &vi : fn->captures)
+			visit(vi);
+	} catch (...) {
+		clear_locals(base, size);
+		throw;
 	}
+	auto &captured = ret.f_val().captured;
+	captured.reserve(size);
+	for (auto i = 0u; i < size; i++)
+		captured.emplace_back(move(local(base + i)));
+	clear_locals(base, size);
+	return ret;
 }
 
-void vm::visit_break_stmt_node(const shared_ptr<break_stmt_node> &node) {
-	throw loop_break(node->cnt); // Yeah!!!!
+completion vm::visit_empty_stmt_node(empty_stmt_node *node) {
+	return completion();
+}
+
+completion vm::visit_if_stmt_node(if_stmt_node *node) {
+	const auto cond = eval(node->cond);
+	if (cond.type != object_type::boolean)
+		throw runtime_error(L"condition for an if stmt must be boolean!");
+	if (cond.b_val)
+		return run(node->branch);
+	if (node->else_branch != nullptr)
+		return run(node->else_branch);
+	return completion();
+}
+
+completion vm::visit_while_stmt_node(while_stmt_node *node) {
+	auto cond = eval(node->cond);
+	if (cond.type != object_type::boolean)
+		throw runtime_error(L"condition for a while stmt must be boolean!");
+	while (cond.b_val) {
+		const auto c = run(node->body);
+		if (c.type == completion::brk) {
+			if (c.cnt > 1)
+				return completion(completion::brk, c.cnt - 1);
+			break;
+		}
+		if (c.type != completion::normal)
+			return c;
+		cond = eval(node->cond);
+		if (cond.type != object_type::boolean)
+			throw runtime_error(L"condition for a while stmt must be boolean!");
+	}
+	return completion();
 }
 
-void vm::visit_return_stmt_node(const shared_ptr<return_stmt_node> &node) {
-	const auto val = rve.visit(node->val);
-	throw function_return(val);
+completion vm::visit_break_stmt_node(break_stmt_node *node) {
+	return completion(completion::brk, node->cnt);
 }
 
-void vm::visit_intrinsic_node(const shared_ptr<intrinsic_node> &node) {
-	node->body(*this);
+completion vm::visit_return_stmt_node(return_stmt_node *node) {
+	if (node->val->type_id == fn_call_node::TYPE_ID) {
+		rve.prepare_call(static_cast<fn_call_node*>(node->val), tail_call);
+		return completion(completion::tail);
+	}
+	ret_val = eval(node->val);
+	return completion(completion::ret);
 }
 
-void vm::visit_block_node(const shared_ptr<block_node> &node) {
+completion vm::visit_block_node(block_node *node) {
 	try {
-		current_frame->push();
-		for (auto &s : node->stmts)
-			visit(s);
-		current_frame->pop();
+		for (auto &s : node->stmts) {
+			const auto c = run(s);
+			if (c.type != completion::normal) {
+				clear_locals(node->base, node->slots);
+				return c;
+			}
+		}
+		clear_locals(node->base, node->slots);
 	} catch(...) { // Clean up scope
-		current_frame->pop();
+		clear_locals(node->base, node->slots);
 		throw;
 	}
+	return completion();
 }
 
-void vm::visit_expr_stmt_node(const shared_ptr<expr_stmt_node> &node) {
+completion vm::visit_expr_stmt_node(expr_stmt_node *node) {
 #ifdef EXPR_STMT_PRINT_RESULT
-	const auto res = rve.visit(node->expr);
-	wcout << *res << endl;
+	const auto res = eval(node->expr);
+	wcout << res << endl;
 #else
-	rve.visit(node->expr);
+	eval(node->expr);
 #endif
+	return completion();
 }
 
-void vm::visit_var_decl_node(const shared_ptr<var_decl_node> &node) {
+completion vm::visit_var_decl_node(var_decl_node *node) {
 	for (auto &vi : node->vars)
 		visit(vi);
+	return completion();
 }
 
-void vm::visit_var_init_node(const shared_ptr<var_init_node> &node) {
-	const auto init = rve.visit(node->init);
-	current_frame->top().set(node->id->id, init);
+completion vm::visit_var_init_node(var_init_node *node) {
+	const auto init = node->init == nullptr ? get_nothing() : eval(node->init);
+	local(node->addr.slot) = init;
+	return completion();
 }
 
-void vm::visit_module_node(const shared_ptr<module_node> &node) {
-	for (auto &decl : node->decls) { // Initialize global variables in order
+completion vm::visit_module_node(module_node *node) {
+	run_module(node, nullptr, 0);
+	return completion();
+}
+
+/*
+ * Initialize the globals of a module in order, then call entry with the first argc params set
+ */
+value vm::run_module(module_node *node, const value *args, const size_t argc) {
+	frame_base = push_frame(node->slots); // For captures of lambdas outside of functions
+	for (auto &decl : node->decls) {
+		if (lines != nullptr)
+			lines->hit(decl);
 		for (auto &vi : decl->vars) {
-			const auto init = rve.visit(vi->init);
-			global.set(vi->id->id, init);
+			const auto init = vi->init == nullptr ? get_nothing() : eval(vi->init);
+			globals[vi->addr.slot] = init;
 		}
 	}
-	const auto entry = global.get(L"entry");
-	if (entry->type != object_type::function)
-		throw runtime_error(L"entry should be a function to call");
-	push_frame();
-	visit(entry->f_val.func->body);
-	pop_frame();
+	return start(get_global(global_id(L"entry")), args, argc);
 }
 
-object::ptr_ref vm::rvalue_evaluator::visit_lvalue(const shared_ptr<expr_node> &node) const {
-	return ctx.lve.visit(node);
+/*
+ * Call entry with the first argc params set, the others are left unset
+ */
+value vm::start(const value &entry, const value *args, const size_t argc) {
+	if (entry.type != object_type::function)
+		throw runtime_error(L"entry should be a function to call");
+	const auto fn = entry.f_val().func;
+	if (argc > fn->params.size())
+		throw runtime_error(L"entry takes " + to_wstring(fn->params.size()) + L" arguments at most");
+	pending_call call;
+	call.callee = entry;
+	call.base = push_frame(fn->slots);
+	for (auto i = 0u; i < argc; i++)
+		stack[call.base + fn->params[i]->addr.slot] = args[i];
+	call.argc = fn->params.size();
+	return invoke(move(call));
+}
+
+// Is a numeric value zero, used to report division by zero instead of crashing in GMP
+static bool is_zero(const value &val) {
+	switch (val.type) {
+	case object_type::fixnum: return val.n_val == 0;
+	case object_type::integer: return sgn(val.i_val()) == 0;
+	case object_type::decimal: return sgn(val.d_val()) == 0;
+	default: return false;
+	}
 }
 
-object::ptr vm::rvalue_evaluator::visit_binop_node(const shared_ptr<binop_node> &node) {
-	switch (node->op) {
-#define ARITH_BINOP(op_enum, op) case op_enum: { \
-		const auto lhs = visit(node->lhs), rhs = visit(node->rhs); \
-		if (lhs->type == object_type::integer && rhs->type == object_type::integer) \
-			return ctx.get_int(lhs->i_val op rhs->i_val); \
-		if (lhs->type == object_type::integer && rhs->type == object_type::decimal) \
-			return ctx.get_decimal(lhs->i_val op rhs->d_val); \
-		if (lhs->type == object_type::decimal && rhs->type == object_type::integer) \
-			return ctx.get_decimal(lhs->d_val op rhs->i_val); \
-		if (lhs->type == object_type::decimal && rhs->type == object_type::decimal) \
-			return ctx.get_decimal(lhs->d_val op rhs->d_val); \
+value vm::binop(const binary_op op, const value &lhs, const value &rhs) const {
+	switch (op) {
+#define ARITH_BINOP(op_enum, op, fixnum_op) case op_enum: { \
+		if (op_enum == binary_op::div && is_zero(rhs)) \
+			throw runtime_error(L"division by zero"); \
+		if (lhs.type == object_type::fixnum && rhs.type == object_type::fixnum) { \
+			fixnum res; \
+			if (fixnum_op(lhs.n_val, rhs.n_val, res)) \
+				return get_fixnum(res); \
+		} \
+		if (lhs.is_integer() && rhs.is_integer()) { \
+			auto res = pool.integer(); \
+			res->i_val = mpz_view(lhs).get() op mpz_view(rhs).get(); \
+			return get_int(move(res)); \
+		} \
+		if (lhs.type == object_type::decimal || rhs.type == object_type::decimal) { \
+			auto res = pool.decimal(); \
+			if (lhs.is_integer() && rhs.type == object_type::decimal) \
+				res->d_val = mpz_view(lhs).get() op rhs.d_val(); \
+			else if (lhs.type == object_type::decimal && rhs.is_integer()) \
+				res->d_val = lhs.d_val() op mpz_view(rhs).get(); \
+			else if (lhs.type == object_type::decimal && rhs.type == object_type::decimal) \
+				res->d_val = lhs.d_val() op rhs.d_val(); \
+			else \
+				throw runtime_error(L"cannot perform arithmetic operation on non-numeric type"); \
+			return value(move(res)); \
+		} \
 		throw runtime_error(L"cannot perform arithmetic operation on non-numeric type"); \
 		}
 #define COMPARE_BINOP(op_enum, op) case op_enum: { \
-		const auto lhs = visit(node->lhs), rhs = visit(node->rhs); \
-		if (lhs->type == object_type::integer && rhs->type == object_type::integer) \
-			return ctx.get_bool(lhs->i_val op rhs->i_val); \
-		if (lhs->type == object_type::integer && rhs->type == object_type::decimal) \
-			return ctx.get_bool(lhs->i_val op rhs->d_val); \
-		if (lhs->type == object_type::decimal && rhs->type == object_type::integer) \
-			return ctx.get_bool(lhs->d_val op rhs->i_val); \
-		if (lhs->type == object_type::decimal && rhs->type == object_type::decimal) \
-			return ctx.get_bool(lhs->d_val op rhs->d_val); \
+		if (lhs.type == object_type::fixnum && rhs.type == object_type::fixnum) \
+			return get_bool(lhs.n_val op rhs.n_val); \
+		if (lhs.is_integer() && rhs.is_integer()) \
+			return get_bool(mpz_view(lhs).get() op mpz_view(rhs).get()); \
+		if (lhs.is_integer() && rhs.type == object_type::decimal) \
+			return get_bool(mpz_view(lhs).get() op rhs.d_val()); \
+		if (lhs.type == object_type::decimal && rhs.is_integer()) \
+			return get_bool(lhs.d_val() op mpz_view(rhs).get()); \
+		if (lhs.type == object_type::decimal && rhs.type == object_type::decimal) \
+			return get_bool(lhs.d_val() op rhs.d_val()); \
 		throw runtime_error(L"cannot perform arithmetic comparison on non-numeric type"); \
 		}
 #define LOGICAL_BINOP(op_enum, op) case op_enum: { \
-		const auto lhs = visit(node->lhs), rhs = visit(node->rhs); \
-		if (lhs->type == object_type::boolean && rhs->type == object_type::boolean) \
-			return ctx.get_bool(lhs->b_val op rhs->b_val); \
+		if (lhs.type == object_type::boolean && rhs.type == object_type::boolean) \
+			return get_bool(lhs.b_val op rhs.b_val); \
 		throw runtime_error(L"cannot perform logical operation on non-boolean type"); \
 		}
-	ARITH_BINOP(binary_op::add, +)
-	ARITH_BINOP(binary_op::sub, -)
-	ARITH_BINOP(binary_op::mul, *)
-	ARITH_BINOP(binary_op::div, /)
+	ARITH_BINOP(binary_op::add, +, fixnum_add)
+	ARITH_BINOP(binary_op::sub, -, fixnum_sub)
+	ARITH_BINOP(binary_op::mul, *, fixnum_mul)
+	ARITH_BINOP(binary_op::div, /, fixnum_div)
 
 	LOGICAL_BINOP(binary_op::land, &&)
 	LOGICAL_BINOP(binary_op::lor, ||)
@@ -256,108 +429,447 @@ object::ptr vm::rvalue_evaluator::visit_binop_node(const shared_ptr<binop_node>
 	COMPARE_BINOP(binary_op::neq, !=)
 
 	case binary_op::assign:
-		return visit_lvalue(node->lhs) = visit(node->rhs);
+		break; // Assignment needs an lvalue, handled by the evaluators
 	}
 	unreachable("evaluating binary expression");
-	return nullptr;
+	return value();
 }
 
-object::ptr vm::rvalue_evaluator::visit_fn_node(const shared_ptr<fn_node> &node) {
-	return ctx.get_fn(node);
+value vm::unop(const unary_op op, const value &val) const {
+	switch (op) {
+	case unary_op::neg: {
+		if (val.type == object_type::fixnum)
+			return get_fixnum(-val.n_val); // Fixnum range is symmetric
+		if (val.type == object_type::integer)
+			return get_int(-val.i_val());
+		if (val.type == object_type::decimal)
+			return get_decimal(-val.d_val());
+		throw runtime_error(L"cannot perform numeric negation on non-numeric type");
+	}
+	case unary_op::lnot: {
+		if (val.type == object_type::boolean)
+			return get_bool(!val.b_val);
+		throw runtime_error(L"cannot perform logical negation on non-boolean type");
+	}
+	}
+	unreachable("evaluating unary expression");
+	return value();
 }
 
-object::ptr vm::rvalue_evaluator::visit_fn_call_node(const shared_ptr<fn_call_node> &node) {
-	const auto callee = visit(node->callee); // Calculate the callee
-	if (callee->type != object_type::function) // If callee is not a function
-		throw runtime_error(L"can not \"call\" a non-function object");
-
-	const auto &fn = callee->f_val.func;
-	if (node->args.size() > fn->params.size()) // If we have more arguments than callee is expected to receive
+value vm::call_native(const native_function &fn, const value *args, const size_t argc) {
+	if (argc > fn.arity)
 		throw runtime_error(L"too many arguments to call function");
+	if (argc < fn.arity)
+		throw runtime_error(L"too few arguments to call native function \"" + wstring(fn.name) + L"\"");
+	return fn.body(*this, args);
+}
+
+value vm::call(const value &callee, const value *args, const size_t argc) {
+	if (callee.type == object_type::native)
+		return call_native(*callee.nf_val, args, argc);
+	const auto &fn = callee.f_val().func;
+	pending_call call;
+	call.callee = callee;
+	call.base = push_frame(fn->slots);
+	for (size_t i = 0; i < argc; i++) // Put arguments
+		stack[call.base + fn->params[i]->addr.slot] = args[i];
+	call.argc = argc;
+	return invoke(move(call));
+}
+
+/*
+ * Plan a call site for a function, the call is known to give it no more than its params
+ */
+void vm::plan_call(call_cache &cache, fn_node *fn, const size_t argc) const {
+	cache.target = fn;
+	cache.defaults.clear();
+	for (auto i = argc; i < fn->params.size(); i++) {
+		const auto init = fn->params[i]->init;
+		if (init == nullptr)
+			cache.defaults.emplace_back();
+		else if (init->type_id == integer_node::TYPE_ID)
+			cache.defaults.emplace_back(static_cast<integer_node*>(init)->value_obj);
+		else if (init->type_id == decimal_node::TYPE_ID)
+			cache.defaults.emplace_back(static_cast<decimal_node*>(init)->value_obj);
+		else if (init->type_id == bool_node::TYPE_ID)
+			cache.defaults.emplace_back(static_cast<bool_node*>(init)->value);
+		else
+			cache.defaults.emplace_back();
+	}
+}
 
-	vector<object::ptr> args;
-	for (auto &arg : node->args)
-		args.emplace_back(visit(arg)); // Evaluate args before new frame pushed
+/*
+ * Lay out the frame of a call whose callee and arguments were evaluated in a row by machine code,
+ * they are moved into the frame. The call is already checked like prepare_call does.
+ */
+vm::pending_call vm::bind_call(fn_call_node *node, value *callee) {
+	pending_call call;
+	call.callee = move(*callee);
+	const auto args = callee + 1;
+	const auto argc = node->args.size();
+	call.argc = argc;
+	if (call.callee.type == object_type::native) {
+		call.base = push_frame(unsigned(argc));
+		move(args, args + argc, stack.begin() + call.base);
+		return call;
+	}
+	const auto fn = call.callee.f_val().func;
+	auto &cache = node->cache;
+	if (fn != cache.target)
+		plan_call(cache, fn, argc);
+	call.base = push_frame(fn->slots); // Params follow captures
+	move(args, args + argc, stack.begin() + call.base + fn->captures.size());
+	call.cache = &cache;
+	return call;
+}
+
+/*
+ * Run a call in its frame, calls in tail position are moved down to run in the same frame one after another.
+ * The frame is popped when it returns.
+ */
+value vm::invoke(pending_call call) {
+	const auto caller_base = frame_base;
+	frame_base = call.base;
+	if (prof != nullptr)
+		prof->enter(call.callee);
+	try {
+		const call_depth counted(*this);
+		for (;;) {
+			if (call.callee.type == object_type::native) { // Arguments are in place and checked already
+				auto ret = call.callee.nf_val->body(*this, stack.data() + frame_base);
+				pop_frame(frame_base);
+				frame_base = caller_base;
+				if (prof != nullptr)
+					prof->leave();
+				return ret;
+			}
+			const auto fn = call.callee.f_val().func;
+			const auto &captured = call.callee.f_val().captured;
+			copy(captured.begin(), captured.end(), stack.begin() + frame_base); // Put captured variables
+			for (auto i = call.argc; i < fn->params.size(); i++) { // Put default arguments, if any
+				auto &vi = fn->params[i];
+				// Checked for each default, evaluating one may call through the same site and plan it again
+				const auto cache = call.cache != nullptr && call.cache->target == fn ? call.cache : nullptr;
+				if (cache != nullptr && !cache->defaults[i - call.argc].undefined()) {
+					local(vi->addr.slot) = cache->defaults[i - call.argc];
+					continue;
+				}
+				if (vi->init == nullptr)
+					throw runtime_error(L"unprovided call argument \"" + symbols.name(vi->id->id) + L"\" must have its default value");
+				visit(vi);
+			}
+			const auto c = run_body(fn); // Execute function body
+			if (c.type == completion::brk)
+				throw runtime_error(L"cannot break out of a function");
+			if (c.type == completion::tail) { // Reuse the frame
+				call = move(tail_call);
+				const auto size = call.callee.type == object_type::native ? call.argc : call.callee.f_val().func->slots;
+				move(stack.begin() + call.base, stack.begin() + call.base + size, stack.begin() + frame_base);
+				pop_frame(frame_base + size);
+				call.base = frame_base;
+				if (prof != nullptr) { // The callee takes the place of the caller
+					prof->leave();
+					prof->enter(call.callee);
+				}
+				continue;
+			}
+			pop_frame(frame_base); // Clear stack
+			frame_base = caller_base;
+			if (prof != nullptr)
+				prof->leave();
+			if (c.type == completion::ret)
+				return move(ret_val);
+			return get_nothing();
+		}
+	} catch (...) {
+		pop_frame(frame_base); // Clear stack
+		frame_base = caller_base;
+		if (prof != nullptr)
+			prof->leave();
+		throw;
+	}
+}
 
-	ctx.push_frame(); // New frame on stack
-	ctx.current_frame->push(); // Push captured variables
-	for (auto &it : callee->f_val.captured)
-		ctx.current_frame->set(it.first, it.second);
+/*
+ * Run the body of a function in the current frame, through machine code once the jit has compiled it
+ */
+completion vm::run_body(fn_node *fn) {
+	if (jit_engine != nullptr) {
+		if (fn->compiled == nullptr && fn->calls++ == opts.jit_after)
+			fn->compiled = jit_engine->compile(fn);
+		if (fn->compiled != nullptr)
+			return jit_engine->run(*this, *fn->compiled);
+	}
+	return run(fn->body);
+}
 
-	try {
-		for (auto i = 0; i < node->args.size(); i++) { // Put arguments
-			auto &vi = fn->params[i];
-			ctx.current_frame->top().set(vi->id->id, args[i]);
+value vm::import(const shared_value &val) const {
+	switch (val.type()) {
+	case object_type::integer: {
+		auto obj = pool.integer();
+		obj->i_val = val.boxed().i_val;
+		return value(move(obj));
+	}
+	case object_type::decimal: {
+		auto obj = pool.decimal();
+		obj->d_val = val.boxed().d_val;
+		return value(move(obj));
+	}
+	default:
+		return val.immediate();
+	}
+}
+
+value &vm::rvalue_evaluator::visit_lvalue(expr_node *node) const {
+	return ctx.lve.visit(node);
+}
+
+/*
+ * The variant of a binary operator for the types of its operands, generic if there is none
+ */
+static quick_op quicken(const binary_op op, const value &lhs, const value &rhs) {
+	if (lhs.type != rhs.type)
+		return quick_op::generic;
+	switch (lhs.type) {
+	case object_type::fixnum:
+		switch (op) {
+		case binary_op::add: return quick_op::add_fixnum;
+		case binary_op::sub: return quick_op::sub_fixnum;
+		case binary_op::mul: return quick_op::mul_fixnum;
+		case binary_op::div: return quick_op::div_fixnum;
+		case binary_op::lt: return quick_op::lt_fixnum;
+		case binary_op::lteq: return quick_op::lteq_fixnum;
+		case binary_op::gt: return quick_op::gt_fixnum;
+		case binary_op::gteq: return quick_op::gteq_fixnum;
+		case binary_op::eq: return quick_op::eq_fixnum;
+		case binary_op::neq: return quick_op::neq_fixnum;
+		default: return quick_op::generic;
 		}
-		for (auto i = node->args.size(); i < fn->params.size(); i++) { // Put default arguments, if any
-			auto &vi = fn->params[i];
-			if (vi->init == nullptr)
-				throw runtime_error(L"unprovided call argument \"" + vi->id->id + L"\" must have its default value");
-			visit(vi);
+	case object_type::decimal:
+		switch (op) {
+		case binary_op::add: return quick_op::add_decimal;
+		case binary_op::sub: return quick_op::sub_decimal;
+		case binary_op::mul: return quick_op::mul_decimal;
+		case binary_op::div: return quick_op::div_decimal;
+		case binary_op::lt: return quick_op::lt_decimal;
+		case binary_op::lteq: return quick_op::lteq_decimal;
+		case binary_op::gt: return quick_op::gt_decimal;
+		case binary_op::gteq: return quick_op::gteq_decimal;
+		case binary_op::eq: return quick_op::eq_decimal;
+		case binary_op::neq: return quick_op::neq_decimal;
+		default: return quick_op::generic;
 		}
-		ctx.visit(fn->body); // Execute function body
-		ctx.current_frame->pop();
-		ctx.pop_frame(); // Clear stack	
-	} catch (runtime_error&) {
-		ctx.current_frame->pop();
-		ctx.pop_frame(); // Clear stack	
-		throw;
-	} catch (function_return &fr) { // We use errors to return values
-		ctx.current_frame->pop();
-		ctx.pop_frame(); // Clear stack	
-		return fr.value;
+	case object_type::boolean:
+		switch (op) {
+		case binary_op::land: return quick_op::land_boolean;
+		case binary_op::lor: return quick_op::lor_boolean;
+		default: return quick_op::generic;
+		}
+	default:
+		return quick_op::generic;
 	}
-	return ctx.get_nothing();
 }
 
-object::ptr vm::rvalue_evaluator::visit_unop_node(const shared_ptr<unop_node> &node) {
-	switch (node->op) {
-	case unary_op::neg: {
-		const auto val = visit(node->operand);
-		if (val->type == object_type::integer)
-			return ctx.get_int(-val->i_val);
-		if (val->type == object_type::decimal)
-			return ctx.get_decimal(-val->d_val);
-		throw runtime_error(L"cannot perform numeric negation on non-numeric type");
+static quick_op quicken(const unary_op op, const value &val) {
+	if (op == unary_op::neg && val.type == object_type::fixnum)
+		return quick_op::neg_fixnum;
+	if (op == unary_op::neg && val.type == object_type::decimal)
+		return quick_op::neg_decimal;
+	if (op == unary_op::lnot && val.type == object_type::boolean)
+		return quick_op::lnot_boolean;
+	return quick_op::generic;
+}
+
+/*
+ * A quickened node checks only the types it is specialized for, a type miss turns it generic.
+ * Overflows and divisions by zero are left to vm::binop without turning the node generic.
+ */
+value vm::rvalue_evaluator::visit_binop_node(binop_node *node) {
+	if (node->op == binary_op::assign)
+		return visit_lvalue(node->lhs) = ctx.eval(node->rhs);
+	const auto lhs = ctx.eval(node->lhs), rhs = ctx.eval(node->rhs);
+	switch (node->quick) {
+#define QUICK_FIXNUM_ARITH(variant, fixnum_op) case variant: \
+		if (lhs.type == object_type::fixnum && rhs.type == object_type::fixnum) { \
+			fixnum res; \
+			if ((variant != quick_op::div_fixnum || rhs.n_val != 0) && fixnum_op(lhs.n_val, rhs.n_val, res)) \
+				return ctx.get_fixnum(res); \
+			return ctx.binop(node->op, lhs, rhs); \
+		} \
+		break;
+#define QUICK_FIXNUM_COMPARE(variant, c_op) case variant: \
+		if (lhs.type == object_type::fixnum && rhs.type == object_type::fixnum) \
+			return ctx.get_bool(lhs.n_val c_op rhs.n_val); \
+		break;
+#define QUICK_DECIMAL_ARITH(variant, c_op) case variant: \
+		if (lhs.type == object_type::decimal && rhs.type == object_type::decimal) { \
+			if (variant == quick_op::div_decimal && sgn(rhs.d_val()) == 0) \
+				return ctx.binop(node->op, lhs, rhs); \
+			auto res = ctx.pool.decimal(); \
+			res->d_val = lhs.d_val() c_op rhs.d_val(); \
+			return value(move(res)); \
+		} \
+		break;
+#define QUICK_DECIMAL_COMPARE(variant, c_op) case variant: \
+		if (lhs.type == object_type::decimal && rhs.type == object_type::decimal) \
+			return ctx.get_bool(lhs.d_val() c_op rhs.d_val()); \
+		break;
+#define QUICK_LOGICAL(variant, c_op) case variant: \
+		if (lhs.type == object_type::boolean && rhs.type == object_type::boolean) \
+			return ctx.get_bool(lhs.b_val c_op rhs.b_val); \
+		break;
+	QUICK_FIXNUM_ARITH(quick_op::add_fixnum, fixnum_add)
+	QUICK_FIXNUM_ARITH(quick_op::sub_fixnum, fixnum_sub)
+	QUICK_FIXNUM_ARITH(quick_op::mul_fixnum, fixnum_mul)
+	QUICK_FIXNUM_ARITH(quick_op::div_fixnum, fixnum_div)
+	QUICK_FIXNUM_COMPARE(quick_op::lt_fixnum, <)
+	QUICK_FIXNUM_COMPARE(quick_op::lteq_fixnum, <=)
+	QUICK_FIXNUM_COMPARE(quick_op::gt_fixnum, >)
+	QUICK_FIXNUM_COMPARE(quick_op::gteq_fixnum, >=)
+	QUICK_FIXNUM_COMPARE(quick_op::eq_fixnum, ==)
+	QUICK_FIXNUM_COMPARE(quick_op::neq_fixnum, !=)
+
+	QUICK_DECIMAL_ARITH(quick_op::add_decimal, +)
+	QUICK_DECIMAL_ARITH(quick_op::sub_decimal, -)
+	QUICK_DECIMAL_ARITH(quick_op::mul_decimal, *)
+	QUICK_DECIMAL_ARITH(quick_op::div_decimal, /)
+	QUICK_DECIMAL_COMPARE(quick_op::lt_decimal, <)
+	QUICK_DECIMAL_COMPARE(quick_op::lteq_decimal, <=)
+	QUICK_DECIMAL_COMPARE(quick_op::gt_decimal, >)
+	QUICK_DECIMAL_COMPARE(quick_op::gteq_decimal, >=)
+	QUICK_DECIMAL_COMPARE(quick_op::eq_decimal, ==)
+	QUICK_DECIMAL_COMPARE(quick_op::neq_decimal, !=)
+
+	QUICK_LOGICAL(quick_op::land_boolean, &&)
+	QUICK_LOGICAL(quick_op::lor_boolean, ||)
+#undef QUICK_FIXNUM_ARITH
+#undef QUICK_FIXNUM_COMPARE
+#undef QUICK_DECIMAL_ARITH
+#undef QUICK_DECIMAL_COMPARE
+#undef QUICK_LOGICAL
+	case quick_op::unseen:
+		node->quick = quicken(node->op, lhs, rhs);
+		return ctx.binop(node->op, lhs, rhs);
+	default:
+		return ctx.binop(node->op, lhs, rhs);
 	}
-	case unary_op::lnot: {
-		const auto val = visit(node->operand);
-		if (val->type == object_type::boolean)
-			return ctx.get_bool(!val->b_val);
-		throw runtime_error(L"cannot perform logical negation on non-boolean type");
+	node->quick = quick_op::generic; // Types changed
+	return ctx.binop(node->op, lhs, rhs);
+}
+
+value vm::rvalue_evaluator::visit_fn_node(fn_node *node) {
+	return ctx.get_fn(node);
+}
+
+/*
+ * Evaluate the callee of a call, and its arguments straight into the frame of the callee
+ * on the top of the stack (other calls made meanwhile push and pop their frames above it)
+ */
+void vm::rvalue_evaluator::prepare_call(fn_call_node *node, pending_call &call) {
+	call.callee = ctx.eval(node->callee); // Calculate the callee
+	const auto argc = node->args.size();
+	if (call.callee.type == object_type::native) {
+		const auto &native = *call.callee.nf_val;
+		if (argc != native.arity) // Let call_native() report it
+			ctx.call_native(native, nullptr, argc);
+		call.base = ctx.push_frame(unsigned(argc));
+		try {
+			for (size_t i = 0; i < argc; i++)
+				ctx.stack[call.base + i] = ctx.eval(node->args[i]);
+		} catch (...) {
+			ctx.pop_frame(call.base);
+			throw;
+		}
+		call.argc = argc;
+		call.cache = nullptr;
+		return;
 	}
+	if (call.callee.type != object_type::function) // If callee is not a function
+		throw runtime_error(L"can not \"call\" a non-function object");
+
+	const auto fn = call.callee.f_val().func;
+	auto &cache = node->cache;
+	if (fn != cache.target) { // Not the function we planned for
+		if (argc > fn->params.size()) // If we have more arguments than callee is expected to receive
+			throw runtime_error(L"too many arguments to call function");
+		ctx.plan_call(cache, fn, argc);
 	}
-	unreachable("evaluating unary expression");
-	return nullptr;
+
+	call.base = ctx.push_frame(fn->slots); // Params follow captures
+	const auto args = call.base + fn->captures.size();
+	try {
+		for (size_t i = 0; i < argc; i++)
+			ctx.stack[args + i] = ctx.eval(node->args[i]);
+	} catch (...) {
+		ctx.pop_frame(call.base);
+		throw;
+	}
+	if (fn != cache.target) // Evaluating args may call something else here
+		ctx.plan_call(cache, fn, argc);
+	call.argc = argc;
+	call.cache = &cache;
+}
+
+value vm::rvalue_evaluator::visit_fn_call_node(fn_call_node *node) {
+	pending_call call;
+	prepare_call(node, call);
+	return ctx.invoke(move(call));
+}
+
+value vm::rvalue_evaluator::visit_unop_node(unop_node *node) {
+	const auto val = ctx.eval(node->operand);
+	switch (node->quick) {
+	case quick_op::neg_fixnum:
+		if (val.type == object_type::fixnum)
+			return ctx.get_fixnum(-val.n_val); // Fixnum range is symmetric
+		break;
+	case quick_op::neg_decimal:
+		if (val.type == object_type::decimal) {
+			auto res = ctx.pool.decimal();
+			mpf_neg(res->d_val.get_mpf_t(), val.d_val().get_mpf_t());
+			return value(move(res));
+		}
+		break;
+	case quick_op::lnot_boolean:
+		if (val.type == object_type::boolean)
+			return ctx.get_bool(!val.b_val);
+		break;
+	case quick_op::unseen:
+		node->quick = quicken(node->op, val);
+		return ctx.unop(node->op, val);
+	default:
+		return ctx.unop(node->op, val);
+	}
+	node->quick = quick_op::generic; // Type changed
+	return ctx.unop(node->op, val);
 }
 
-object::ptr vm::rvalue_evaluator::visit_bool_node(const shared_ptr<bool_node> &node) {
+value vm::rvalue_evaluator::visit_bool_node(bool_node *node) {
 	return ctx.get_bool(node->value);
 }
 
-object::ptr vm::rvalue_evaluator::visit_decimal_node(const shared_ptr<decimal_node> &node) {
+value vm::rvalue_evaluator::visit_decimal_node(decimal_node *node) {
 	return node->value_obj;
 }
 
-object::ptr vm::rvalue_evaluator::visit_integer_node(const shared_ptr<integer_node> &node) {
+value vm::rvalue_evaluator::visit_integer_node(integer_node *node) {
 	return node->value_obj;
 }
 
-object::ptr vm::rvalue_evaluator::visit_identifier_node(const shared_ptr<identifier_node> &node) {
-	const auto val = ctx.get(node->id);
-	return val;
+value vm::rvalue_evaluator::visit_identifier_node(identifier_node *node) {
+	return ctx.get(*node);
 }
 
 void vm::rvalue_evaluator::unexpected_visit() {
 	unreachable("evaluating rvalue");
 }
 
-object::ptr vm::lvalue_evaluator::visit_rvalue(const shared_ptr<expr_node> &node) const {
-	return ctx.rve.visit(node);
+value vm::lvalue_evaluator::visit_rvalue(expr_node *node) const {
+	return ctx.eval(node);
 }
 
-object::ptr_ref vm::lvalue_evaluator::visit_identifier_node(const shared_ptr<identifier_node> &node) {
-	return ctx.get(node->id);
+value &vm::lvalue_evaluator::visit_identifier_node(identifier_node *node) {
+	return ctx.get(*node);
 }
 
 void vm::lvalue_evaluator::unexpected_visit() {
@@ -1,89 +1,235 @@
 #pragma once
-#include <stack>
+#include <string>
+#include <unordered_map>
+#include <vector>
 #include "runtime.h"
 #include "ast.h"
+#include "jit.h"
+#include "pool.h"
+#include "profiler.h"
 
 namespace alanfl {
+	/*
+	 * How a statement completes, break and return travel up through the statements as this,
+	 * the value of a return is put in vm::ret_val.
+	 * A return of a call is a tail call, the call is put in vm::tail_call and made by the caller in the same frame.
+	 */
+	struct completion {
+		enum completion_type { normal, brk, ret, tail } type;
+		unsigned cnt; // Loops left to break out of
+		completion(const completion_type type = normal, const unsigned cnt = 0) : type(type), cnt(cnt) {}
+	};
+
+	/*
+	 * Options a vm is created with
+	 */
+	struct vm_options {
+		bool jit = false; // Compile functions into machine code where the platform allows it
+		unsigned jit_after = 0; // Calls a function runs in the tree-walker (gathering type feedback) before it is compiled
+		std::string profile; // Profile calls and write folded stacks to this file when exec ends, see "profiler.h"
+		bool line_counts = false; // Count statements run (functions are not compiled then), see line_counter
+		unsigned max_depth = 10000; // Calls running at once (tail calls replace their caller), deeper is a stack overflow
+	};
+
 	/*
 	 * The node-based VM for AlanFL
 	 * This is often passes as reference as a context of the language
 	 */
-	class vm : public ast_visitor<> {
-		static const int MAX_CACHE_INT = 127; // Upper bound for caching int
-		static const int MIN_CACHE_INT = -127; // Lower bound for caching int
-		static const int CACHE_SIZE = MAX_CACHE_INT - MIN_CACHE_INT + 1;
-		object::ptr int_cache[CACHE_SIZE]; // Int cache
-		object::ptr bool_true, bool_false; // Bool cache
-		object::ptr nothing; // Nothing cache
+	class vm : public ast_visitor<completion> {
+		static const unsigned NO_GLOBAL = ~0u;
+		static const std::size_t STACK_SIZE = 1 << 20; // Values the stack can hold
 
-		scope global; // Global scope
-		std::stack<frame> call_stack; // Call stack
+		/*
+		 * A call with its arguments evaluated, the frame of the callee is laid out on the top of the stack
+		 * at base, with the first argc params put.
+		 * Literal defaults of the others are taken from the cache if it is planned for the callee.
+		 * A native callee has a frame of just its arguments.
+		 */
+		struct pending_call {
+			value callee;
+			std::size_t base = 0;
+			std::size_t argc = 0;
+			const call_cache *cache = nullptr;
+		};
+
+		/*
+		 * A call of either engine, which takes native stack while it runs.
+		 * Too many at once raise "stack overflow" before the thread runs out of stack.
+		 */
+		struct call_depth {
+			vm &ctx;
+			explicit call_depth(vm &ctx);
+			~call_depth() { ctx.depth--; }
+		};
+
+		mutable object_pool pool; // Boxed objects created by this vm, declared first to be destroyed last
+		const vm_options opts;
+		std::unique_ptr<jit> jit_engine; // Null unless the jit is on
+		std::unique_ptr<profiler> prof; // Null unless profiling
+		std::unique_ptr<line_counter> lines; // Null unless counting statements
+		symbol_table symbols; // Names in code run by this vm
+		value ret_val; // Value of the last return
+		pending_call tail_call; // The call of the last return in tail position
+
+		std::vector<value> globals; // Global variables indexed by global id, undefined if not set yet
+		std::vector<symbol> global_names;
+		std::vector<unsigned> global_ids; // Global id of each symbol, NO_GLOBAL if it has none yet
+		std::vector<value> stack; // Frames of all calls, reserved up front so that it never moves
+		std::size_t frame_base = 0; // Where the current frame starts on the stack
+		unsigned depth = 0; // Calls running, see call_depth
+		std::vector<std::shared_ptr<const void>> trees; // Keeps parsed code alive, functions point into it
 
 		/*
 		 * The evaluator for right values
 		 */
-		class rvalue_evaluator : public ast_visitor<object::ptr> {
+		class rvalue_evaluator final : public ast_visitor<value> {
 			vm &ctx;
 			void unexpected_visit() override;
 
-			object::ptr_ref visit_lvalue(const std::shared_ptr<expr_node> &node) const;
-			object::ptr visit_bool_node(const std::shared_ptr<bool_node> &node) override;
-			object::ptr visit_identifier_node(const std::shared_ptr<identifier_node> &node) override;
-			object::ptr visit_integer_node(const std::shared_ptr<integer_node> &node) override;
-			object::ptr visit_decimal_node(const std::shared_ptr<decimal_node> &node) override;
-			object::ptr visit_fn_node(const std::shared_ptr<fn_node> &node) override;
-			object::ptr visit_fn_call_node(const std::shared_ptr<fn_call_node> &node) override;
-			object::ptr visit_binop_node(const std::shared_ptr<binop_node> &node) override;
-			object::ptr visit_unop_node(const std::shared_ptr<unop_node> &node) override;
+			value &visit_lvalue(expr_node *node) const;
+			value visit_bool_node(bool_node *node) override;
+			value visit_identifier_node(identifier_node *node) override;
+			value visit_integer_node(integer_node *node) override;
+			value visit_decimal_node(decimal_node *node) override;
+			value visit_fn_node(fn_node *node) override;
+			value visit_fn_call_node(fn_call_node *node) override;
+			value visit_binop_node(binop_node *node) override;
+			value visit_unop_node(unop_node *node) override;
+
+			friend value alanfl::thread_expr(vm &ctx, expr_node *node);
 		public:
 			explicit rvalue_evaluator(vm &ctx) : ctx(ctx) {};
+			void prepare_call(fn_call_node *node, pending_call &call);
 		} rve;
 
 		/*
 		 * For left values
 		 */
-		class lvalue_evaluator : public ast_visitor<object::ptr_ref> {
+		class lvalue_evaluator : public ast_visitor<value &> {
 			vm &ctx;
 			void unexpected_visit() override;
 
-			object::ptr visit_rvalue(const std::shared_ptr<expr_node> &node) const;
-			object::ptr_ref visit_identifier_node(const std::shared_ptr<identifier_node> &node) override;
+			value visit_rvalue(expr_node *node) const;
+			value &visit_identifier_node(identifier_node *node) override;
 		public:
 			explicit lvalue_evaluator(vm &ctx) : ctx(ctx) {};
 		} lve;
 
-		void init_obj_cache();
+		static const native_function intrinsics[]; // Registered as globals of every vm
 		void init_intrinsics();
 
-		object::ptr_ref get(const std::wstring &name);
-		object::ptr get_nothing() const;
-		object::ptr get_int(mpz_class z) const;
-		object::ptr get_decimal(mpf_class f) const;
-		object::ptr get_bool(bool b) const;
-		object::ptr get_fn(const std::shared_ptr<fn_node> &fn);
-		object::ptr get_intrinsic(const std::wstring &sig, std::function<void(vm &ctx)> body);
-
-		void visit_empty_stmt_node(const std::shared_ptr<empty_stmt_node> &node) override;
-		void visit_if_stmt_node(const std::shared_ptr<if_stmt_node> &node) override;
-		void visit_while_stmt_node(const std::shared_ptr<while_stmt_node> &node) override;
-		void visit_break_stmt_node(const std::shared_ptr<break_stmt_node> &node) override;
-		void visit_return_stmt_node(const std::shared_ptr<return_stmt_node> &node) override;
-		void visit_intrinsic_node(const std::shared_ptr<intrinsic_node> &node) override;
-		void visit_expr_stmt_node(const std::shared_ptr<expr_stmt_node> &node) override;
-		void visit_var_decl_node(const std::shared_ptr<var_decl_node> &node) override;
-		void visit_var_init_node(const std::shared_ptr<var_init_node> &node) override;
-		void visit_block_node(const std::shared_ptr<block_node> &node) override;
-
-		void visit_module_node(const std::shared_ptr<module_node> &node) override;
+		/*
+		 * Frames are pushed and popped on the top of the stack, a popped frame releases its values.
+		 * A block leaves its slots undefined when it ends, so that they start undefined next time.
+		 */
+		std::size_t push_frame(unsigned size);
+		void pop_frame(std::size_t base) { stack.resize(base); }
+		value &local(const unsigned slot) { return stack[frame_base + slot]; }
+		void clear_locals(unsigned base, unsigned size);
+
+		/*
+		 * Evaluate an expression or run a statement through the handler in the node,
+		 * define VM_SWITCH_DISPATCH to go through the visitors instead (to compare them)
+		 */
+		value eval(expr_node *node) {
+#ifdef VM_SWITCH_DISPATCH
+			return rve.visit(node);
+#else
+			return node->handler(*this, node);
+#endif
+		}
+		completion run(stmt_node *node) {
+#ifdef VM_SWITCH_DISPATCH
+			if (lines != nullptr)
+				lines->hit(node);
+			return visit(node);
+#else
+			return node->handler(*this, node);
+#endif
+		}
+
+		value &get(const identifier_node &node);
+		value &get_global(unsigned id);
+		void set_global(const std::wstring &name, const value &val);
+		value get_nothing() const;
+		value get_int(mpz_class z) const;
+		value get_int(object::ptr obj) const; // An integer object from the pool, demoted to fixnum if it fits
+		value get_fixnum(fixnum n) const;
+		value get_decimal(mpf_class f) const;
+		value get_bool(bool b) const;
+		value get_fn(fn_node *fn);
+		void plan_call(call_cache &cache, fn_node *fn, std::size_t argc) const;
+		pending_call bind_call(fn_call_node *node, value *callee);
+		value invoke(pending_call call);
+		completion run_body(fn_node *fn);
+		value run_module(module_node *node, const value *args, std::size_t argc);
+		value start(const value &entry, const value *args, std::size_t argc);
+
+		completion visit_empty_stmt_node(empty_stmt_node *node) override;
+		completion visit_if_stmt_node(if_stmt_node *node) override;
+		completion visit_while_stmt_node(while_stmt_node *node) override;
+		completion visit_break_stmt_node(break_stmt_node *node) override;
+		completion visit_return_stmt_node(return_stmt_node *node) override;
+		completion visit_expr_stmt_node(expr_stmt_node *node) override;
+		completion visit_var_decl_node(var_decl_node *node) override;
+		completion visit_var_init_node(var_init_node *node) override;
+		completion visit_block_node(block_node *node) override;
+
+		completion visit_module_node(module_node *node) override;
+
+		friend class interpreter; // The bytecode interpreter shares globals and intrinsics with us
+		friend class jit; // So does machine code, through the callbacks of the jit
+		friend value thread_expr(vm &ctx, expr_node *node);
+		friend completion thread_stmt(vm &ctx, stmt_node *node);
 	public:
-		frame *current_frame;
-		void push_frame();
-		void pop_frame();
 		void exec(const std::shared_ptr<ast_node> &node);
-		vm() : global(*this), rve(*this), lve(*this), current_frame(nullptr) {
-			init_obj_cache();
+
+		/*
+		 * Run a module like exec, but with the first argc params of entry set to args,
+		 * what entry returns is given back and errors are thrown instead of printed.
+		 * A module run again starts over, with every global unset but intrinsics.
+		 */
+		value run(const std::shared_ptr<module_node> &mod, const value *args, std::size_t argc);
+
+		/*
+		 * Global variables have ids assigned on first reference, they stay unset until defined
+		 */
+		unsigned global_id(symbol name);
+		unsigned global_id(const std::wstring &name) { return global_id(symbols.intern(name)); }
+
+		/*
+		 * Code run by this vm must be lexed with its symbol table
+		 */
+		symbol_table &get_symbols() { return symbols; }
+
+		/*
+		 * Statements counted so far, null unless vm_options::line_counts is set
+		 */
+		const line_counter *get_line_counts() const { return lines.get(); }
+
+		/*
+		 * Semantics shared by both execution engines, operands are already evaluated.
+		 * call() expects callee to be a function and args no more than its params.
+		 * call_native() checks the arity itself, args are passed as they are.
+		 */
+		value binop(binary_op op, const value &lhs, const value &rhs) const;
+		value unop(unary_op op, const value &val) const;
+		value call(const value &callee, const value *args, std::size_t argc);
+		value call_native(const native_function &fn, const value *args, std::size_t argc);
+
+		/*
+		 * Bring a value from another thread into this vm, see shared_value
+		 */
+		value import(const shared_value &val) const;
+		explicit vm(const vm_options &opts = vm_options()) : opts(opts), rve(*this), lve(*this) {
+			if (opts.jit && !opts.line_counts && jit::available()) // Machine code runs no statement handlers
+				jit_engine.reset(new jit());
+			if (!opts.profile.empty())
+				prof.reset(new profiler());
+			if (opts.line_counts)
+				lines.reset(new line_counter());
+			stack.reserve(STACK_SIZE);
 			init_intrinsics();
-			push_frame(); // Push a dummy frame
 		}
 	};
 }